@@ -0,0 +1,772 @@
+/*
+ * Copyright (c) 2020 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * A stand-alone benchmark of the trace-decoder. A small synthetic
+ * RV32I program (nested loops, recursive calls, data-dependent
+ * branches, and both inferrable and uninferrable jumps) is executed
+ * by a minimal interpreter, and each retired instruction is passed to
+ * the trace-encoder. The resulting te_inst packets are buffered, and
+ * then decoded (and timed), once for each combination of the encoder's
+ * options (implicit_return, jump_target_cache, branch_prediction and
+ * full_address):
+ *
+ *  cc -std=gnu11 -O2 -DNDEBUG -DTE_WITH_STATISTICS \
+ *      -I../src -I<riscv-disassembler>/src \
+ *      -o te-decoder-bench te-decoder-bench.c \
+ *      ../src/decoder-algorithm-public.c ../src/encoder-algorithm-public.c \
+ *      ../src/te-codec-utilities.c ../src/te-shared-image.c \
+ *      <riscv-disassembler>/src/riscv-disas.c
+ *  ./te-decoder-bench [instructions] [decoders] [-n] [-l] [-r] [-u]
+ *
+ * If "decoders" is more than one, then that many trace-decoders each
+ * decode the same packets, with the packets passed to each of them in
+ * turn (round-robin), as when decoding the traces of many harts. With
+ * "-n", no advance_decoded_pc call-back is assigned, otherwise the PCs
+ * reconstructed are checked against those retired.
+ *
+ * With "-l", the program is made much larger, by chaining LARGE_COPIES
+ * copies of it (each with its own loops and functions) into about 6 KiB
+ * of code. Each trace-decoder then fills much of its own decode caches,
+ * so with 64 or more trace-decoders, their states and tables together
+ * are far larger than the L2 cache, as when decoding many harts at once.
+ *
+ * With "-r", each recursive call is DEEP_CALL_DEPTH deep, rather than
+ * CALL_DEPTH, so the implicit return stack (of 2^call_counter_size
+ * entries) overflows on every outer loop, and the oldest return address
+ * is dropped on each call beyond that depth. The PCs reconstructed as
+ * the recursion then unwinds are checked as above, so this also checks
+ * that the decoder's (circular) return stack wraps around correctly.
+ *
+ * Either way, the packets are first decoded by a reference trace-decoder
+ * (untimed), with the advance_decoded_pc call-back, so every PC it
+ * reconstructs is checked against those retired. Then, after each packet,
+ * the PC of each timed trace-decoder is checked against that of the
+ * reference, as is the number of instructions retired (which is only
+ * counted if built with TE_WITH_STATISTICS, as above). This also checks
+ * the paths only taken when nobody observes each PC (e.g. skipping loops,
+ * and multi-branch steps through the CFG), as these may arrive at the
+ * same PC, having retired the wrong number of instructions.
+ *
+ * The time to decode each instruction is reported, so the effect of the
+ * layout of te_decoder_state_t with many trace-decoders may be measured,
+ * even without hardware performance counters. With "-u", the state of
+ * each timed trace-decoder is placed at the start of a block as large as
+ * te_decoder_state_t was, when the return_stack[], jump_target[], bpred
+ * table and decode cache were all embedded in it (see unordered_state_t).
+ * This emulates the stride between the states of that (unordered) layout,
+ * but not the spread of the fields within each one. Compare, for example:
+ *
+ *  ./te-decoder-bench 1000000 64 -n -l
+ *  ./te-decoder-bench 1000000 64 -n -l -u
+ *
+ * On hosts with hardware performance counters, the cache misses of many
+ * such trace-decoders may also be counted with, for example:
+ *
+ *  perf stat -e cache-misses,L1-dcache-load-misses ./te-decoder-bench 1000000 64 -n -l
+ *
+ * To compare the decoder's predicates using the classes calculated once
+ * per instruction, against switching on the opcode every time, build
+ * once more with -DTE_WITHOUT_INSTRUCTION_CLASSES added.
+ */
+
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "decoder-algorithm-public.h"
+#include "encoder-algorithm-public.h"
+
+
+/* default number of instructions to retire */
+#define DEFAULT_INSTRUCTIONS    (1000000u)
+
+/* address and size of the program image, and of the (separate) stack */
+#define IMAGE_BASE      (0x80000000u)
+#define IMAGE_SIZE      (0x2000u)
+#define STACK_BASE      (0x90000000u)
+#define STACK_SIZE      (0x8000u)
+
+/* depth of each recursive call, and with "-r" (16 bytes of stack each) */
+#define CALL_DEPTH      (12)
+#define DEEP_CALL_DEPTH (2000)
+
+/* number of copies of the program with "-l", and of labels in each */
+#define LARGE_COPIES    (16u)
+#define COPY_LABELS     (5u)
+
+/*
+ * With "-u", each timed trace-decoder's state is placed in one of these,
+ * which is as large as te_decoder_state_t was with its tables embedded.
+ */
+#define UNORDERED_GAP_SIZE                                              \
+    (TE_MAX_IRSTACK_DEPTH * sizeof(te_address_t) +                      \
+     TE_JUMP_TARGET_CACHE_SIZE * sizeof(te_address_t) +                 \
+     TE_BRANCH_PREDICTOR_SIZE +                                         \
+     ((size_t)1 << TE_OBSERVED_COLD_CACHE_BITS) * sizeof(te_decoded_instruction_t))
+typedef struct
+{
+    te_decoder_state_t state;
+    uint8_t gap[UNORDERED_GAP_SIZE];
+} unordered_state_t;
+
+/* registers used by the program */
+enum
+{
+    ZERO = 0, RA = 1, SP = 2, T0 = 5, T1 = 6, T2 = 7, S0 = 8, S1 = 9,
+    A0 = 10, A1 = 11, T3 = 28, T4 = 29
+};
+
+
+/*
+ * the program image, and the assembler's state
+ */
+static uint32_t image[IMAGE_SIZE / 4u];
+static uint32_t stack[STACK_SIZE / 4u];
+static size_t cursor;       /* index into image[] of the next instruction */
+
+#define HERE    (IMAGE_BASE + 4u * (uint32_t)cursor)
+
+
+/*
+ * emit one instruction of each of the (32-bit) encoding types
+ */
+static void emit_i(
+    const unsigned opcode,
+    const unsigned rd,
+    const unsigned funct3,
+    const unsigned rs1,
+    const int32_t imm)
+{
+    image[cursor++] = opcode | (rd << 7) | (funct3 << 12) | (rs1 << 15) |
+        (((uint32_t)imm & 0xfffu) << 20);
+}
+
+static void emit_r(
+    const unsigned rd,
+    const unsigned funct3,
+    const unsigned rs1,
+    const unsigned rs2)
+{
+    image[cursor++] = 0x33u | (rd << 7) | (funct3 << 12) | (rs1 << 15) | (rs2 << 20);
+}
+
+static void emit_s(
+    const unsigned rs2,
+    const unsigned rs1,
+    const int32_t imm)
+{
+    const uint32_t u = (uint32_t)imm;
+
+    image[cursor++] = 0x23u | ((u & 0x1fu) << 7) | (2u << 12) | (rs1 << 15) |
+        (rs2 << 20) | (((u >> 5) & 0x7fu) << 25);
+}
+
+static void emit_b(
+    const unsigned funct3,
+    const unsigned rs1,
+    const unsigned rs2,
+    const uint32_t target)
+{
+    const uint32_t u = target - HERE;
+
+    image[cursor++] = 0x63u | (((u >> 11) & 1u) << 7) | (((u >> 1) & 0xfu) << 8) |
+        (funct3 << 12) | (rs1 << 15) | (rs2 << 20) |
+        (((u >> 5) & 0x3fu) << 25) | (((u >> 12) & 1u) << 31);
+}
+
+static void emit_j(
+    const unsigned rd,
+    const uint32_t target)
+{
+    const uint32_t u = target - HERE;
+
+    image[cursor++] = 0x6fu | (rd << 7) | (((u >> 12) & 0xffu) << 12) |
+        (((u >> 11) & 1u) << 20) | (((u >> 1) & 0x3ffu) << 21) |
+        (((u >> 20) & 1u) << 31);
+}
+
+static void emit_u(
+    const unsigned opcode,
+    const unsigned rd,
+    const uint32_t imm)
+{
+    image[cursor++] = opcode | (rd << 7) | (imm & 0xfffff000u);
+}
+
+
+/*
+ * Assemble one copy of the body of the program into image[], using
+ * the COPY_LABELS labels in "labels", and then jumping to the label
+ * "next" (the outer loop of the next copy) at the end of the body.
+ * Each recursive call is "depth" deep.
+ */
+static void assemble_copy(
+    uint32_t * const labels,
+    const uint32_t next,
+    const int32_t depth)
+{
+    /* outer: */
+    labels[0] = HERE;
+    emit_i(0x13u, A0, 0, ZERO, depth);              /* li a0, depth */
+    emit_j(RA, labels[2]);                          /* call recurse */
+    emit_i(0x13u, T0, 0, ZERO, 0);                  /* li t0, 0 */
+
+    /* inner: a counted loop */
+    labels[1] = HERE;
+    emit_i(0x13u, T0, 0, T0, 1);                    /* addi t0, t0, 1 */
+    emit_i(0x13u, T1, 0, ZERO, 100);                /* li t1, 100 */
+    emit_b(4u, T0, T1, labels[1]);                  /* blt t0, t1, inner */
+
+    /* s1 = xorshift32(s1) */
+    emit_i(0x13u, T2, 1u, S1, 13);                  /* slli t2, s1, 13 */
+    emit_r(S1, 4u, S1, T2);                         /* xor s1, s1, t2 */
+    emit_i(0x13u, T2, 5u, S1, 17);                  /* srli t2, s1, 17 */
+    emit_r(S1, 4u, S1, T2);
+    emit_i(0x13u, T2, 1u, S1, 5);                   /* slli t2, s1, 5 */
+    emit_r(S1, 4u, S1, T2);
+
+    /* 16 branches, each taken (or not) at random */
+    for (int32_t bit = 0; bit < 16; bit++)
+    {
+        emit_i(0x13u, T2, 5u, S1, bit);             /* srli t2, s1, bit */
+        emit_i(0x13u, T2, 7u, T2, 1);               /* andi t2, t2, 1 */
+        emit_b(0u, T2, ZERO, HERE + 8u);            /* beqz t2, +8 */
+        emit_i(0x13u, A1, 0, A1, 1);                /* addi a1, a1, 1 */
+    }
+
+    /* an inferrable (sequential) jump, over one instruction */
+    emit_u(0x17u, T3, 0);                           /* auipc t3, 0 */
+    emit_i(0x67u, ZERO, 0, T3, 12);                 /* jr 12(t3) */
+    emit_i(0x13u, ZERO, 0, ZERO, 0);                /* nop (skipped) */
+
+    /* an uninferrable jump, over one instruction */
+    emit_u(0x17u, T4, 0);                           /* auipc t4, 0 */
+    emit_i(0x13u, T4, 0, T4, 16);                   /* addi t4, t4, 16 */
+    emit_i(0x67u, ZERO, 0, T4, 0);                  /* jr 0(t4) */
+    emit_i(0x13u, ZERO, 0, ZERO, 0);                /* nop (skipped) */
+
+    emit_j(RA, labels[4]);                          /* call leaf */
+    emit_i(0x13u, S0, 0, S0, 1);                    /* addi s0, s0, 1 */
+    emit_j(ZERO, next);                             /* j next outer */
+
+    /* recurse: */
+    labels[2] = HERE;
+    emit_b(0u, A0, ZERO, labels[3]);                /* beqz a0, done */
+    emit_i(0x13u, SP, 0, SP, -16);                  /* addi sp, sp, -16 */
+    emit_s(RA, SP, 0);                              /* sw ra, 0(sp) */
+    emit_i(0x13u, A0, 0, A0, -1);                   /* addi a0, a0, -1 */
+    emit_j(RA, labels[2]);                          /* call recurse */
+    emit_i(0x03u, RA, 2u, SP, 0);                   /* lw ra, 0(sp) */
+    emit_i(0x13u, SP, 0, SP, 16);                   /* addi sp, sp, 16 */
+    /* done: */
+    labels[3] = HERE;
+    emit_i(0x67u, ZERO, 0, RA, 0);                  /* ret */
+
+    /* leaf: */
+    labels[4] = HERE;
+    emit_i(0x13u, A1, 0, A1, 1);                    /* addi a1, a1, 1 */
+    emit_i(0x67u, ZERO, 0, RA, 0);                  /* ret */
+}
+
+
+/*
+ * Assemble the program, of "copies" copies of its body, into image[],
+ * with each recursive call "depth" deep. This is done twice, so that
+ * forward references use the labels found on the first pass.
+ */
+static void assemble(
+    uint32_t * const labels,
+    const unsigned copies,
+    const int32_t depth)
+{
+    cursor = 0;
+
+    /* start: */
+    emit_u(0x37u, SP, STACK_BASE + STACK_SIZE);     /* lui sp, top of stack */
+    emit_i(0x13u, S0, 0, ZERO, 0);                  /* li s0, 0 */
+    emit_u(0x37u, S1, 0x12345000u);                 /* li s1, seed */
+    emit_i(0x13u, S1, 0, S1, 0x678);
+
+    for (unsigned copy = 0; copy < copies; copy++)
+    {
+        const unsigned next = (copy + 1u) % copies;
+        assemble_copy(&labels[copy * COPY_LABELS], labels[next * COPY_LABELS], depth);
+    }
+
+    assert(cursor <= sizeof(image) / sizeof(image[0]));
+}
+
+
+/*
+ * sign-extend the least significant "bits" bits of "value"
+ */
+static int32_t sign_extend(
+    const uint32_t value,
+    const unsigned bits)
+{
+    const uint32_t sign = (uint32_t)1 << (bits - 1u);
+    const uint32_t field = value & ((sign << 1) - 1u);
+
+    return (int32_t)(field ^ sign) - (int32_t)sign;
+}
+
+
+/*
+ * Execute the instruction at "*pc" (only those used by the program
+ * are supported), and describe it in "irecord".
+ */
+static void execute(
+    uint32_t * const x,
+    uint32_t * const pc,
+    uint32_t * const last_auipc_rd,
+    te_instruction_record_t * const irecord)
+{
+    const uint32_t inst = image[(*pc - IMAGE_BASE) / 4u];
+    const unsigned opcode = inst & 0x7fu;
+    const unsigned rd = (inst >> 7) & 0x1fu;
+    const unsigned funct3 = (inst >> 12) & 0x7u;
+    const unsigned rs1 = (inst >> 15) & 0x1fu;
+    const unsigned rs2 = (inst >> 20) & 0x1fu;
+    const int32_t imm_i = sign_extend(inst >> 20, 12);
+    const int32_t imm_s = sign_extend(((inst >> 25) << 5) | rd, 12);
+    const int32_t imm_b = sign_extend(((inst >> 31) << 12) | (((inst >> 7) & 1u) << 11) |
+        (((inst >> 25) & 0x3fu) << 5) | (((inst >> 8) & 0xfu) << 1), 13);
+    const int32_t imm_j = sign_extend(((inst >> 31) << 20) | (inst & 0xff000u) |
+        (((inst >> 20) & 1u) << 11) | (((inst >> 21) & 0x3ffu) << 1), 21);
+    uint32_t next_pc = *pc + 4u;
+    uint32_t auipc_rd = ZERO;
+
+    memset(irecord, 0, sizeof(*irecord));
+    irecord->pc = *pc;
+    irecord->is_qualified = true;
+
+    switch (opcode)
+    {
+        case 0x37u:     /* lui */
+            x[rd] = inst & 0xfffff000u;
+            break;
+
+        case 0x17u:     /* auipc */
+            x[rd] = *pc + (inst & 0xfffff000u);
+            auipc_rd = rd;
+            break;
+
+        case 0x13u:     /* addi, slli, srli, andi */
+            switch (funct3)
+            {
+                case 0u: x[rd] = x[rs1] + (uint32_t)imm_i; break;
+                case 1u: x[rd] = x[rs1] << rs2; break;
+                case 5u: x[rd] = x[rs1] >> rs2; break;
+                case 7u: x[rd] = x[rs1] & (uint32_t)imm_i; break;
+                default: assert(!"unsupported instruction"); break;
+            }
+            break;
+
+        case 0x33u:     /* xor */
+            assert(4u == funct3);
+            x[rd] = x[rs1] ^ x[rs2];
+            break;
+
+        case 0x23u:     /* sw */
+            stack[(x[rs1] + (uint32_t)imm_s - STACK_BASE) / 4u] = x[rs2];
+            break;
+
+        case 0x03u:     /* lw */
+            x[rd] = stack[(x[rs1] + (uint32_t)imm_i - STACK_BASE) / 4u];
+            break;
+
+        case 0x63u:     /* beq, blt */
+        {
+            const bool taken = (0u == funct3) ?
+                (x[rs1] == x[rs2]) :
+                ((int32_t)x[rs1] < (int32_t)x[rs2]);
+            irecord->is_branch = true;
+            irecord->cond_code_fail = !taken;
+            if (taken)
+            {
+                next_pc = *pc + (uint32_t)imm_b;
+            }
+            break;
+        }
+
+        case 0x6fu:     /* jal */
+            x[rd] = next_pc;
+            next_pc = *pc + (uint32_t)imm_j;
+            irecord->is_call = (RA == rd);
+            break;
+
+        case 0x67u:     /* jalr */
+            irecord->is_call = (RA == rd);
+            irecord->is_return = (ZERO == rd) && (RA == rs1);
+            /* inferrable, if the target was just computed by auipc */
+            irecord->is_updiscon = (rs1 != *last_auipc_rd);
+            {
+                const uint32_t target = (x[rs1] + (uint32_t)imm_i) & ~1u;
+                x[rd] = next_pc;
+                next_pc = target;
+            }
+            break;
+
+        default:
+            assert(!"unsupported instruction");
+            break;
+    }
+
+    x[ZERO] = 0;
+    *pc = next_pc;
+    *last_auipc_rd = auipc_rd;
+}
+
+
+/*
+ * the buffered te_inst packets, emitted by the trace-encoder
+ */
+static te_inst_t * packets;
+static size_t num_packets;
+static size_t max_packets;
+
+
+/*
+ * the state of the reference trace-decoder after each packet,
+ * with which the state of each timed trace-decoder is compared
+ */
+typedef struct
+{
+    te_address_t pc;
+#if defined(TE_WITH_STATISTICS)
+    size_t num_instructions;
+#endif  /* TE_WITH_STATISTICS */
+} checkpoint_t;
+
+static void save_checkpoint(
+    checkpoint_t * const checkpoint,
+    const te_decoder_state_t * const decoder)
+{
+    checkpoint->pc = decoder->pc;
+#if defined(TE_WITH_STATISTICS)
+    checkpoint->num_instructions = decoder->statistics.num_instructions;
+#endif  /* TE_WITH_STATISTICS */
+}
+
+static bool matches_checkpoint(
+    const checkpoint_t * const checkpoint,
+    const te_decoder_state_t * const decoder)
+{
+    return (checkpoint->pc == decoder->pc)
+#if defined(TE_WITH_STATISTICS)
+        && (checkpoint->num_instructions == decoder->statistics.num_instructions)
+#endif  /* TE_WITH_STATISTICS */
+        ;
+}
+
+static void emit_te_inst(
+    void * const user_data,
+    const te_inst_t * const te_inst)
+{
+    (void)user_data;
+
+    if (num_packets == max_packets)
+    {
+        max_packets = (max_packets) ? (2u * max_packets) : 4096u;
+        packets = realloc(packets, max_packets * sizeof(te_inst_t));
+        assert(packets);
+    }
+    packets[num_packets++] = *te_inst;
+}
+
+
+/*
+ * The PCs reconstructed by each trace-decoder are checked by comparing
+ * a hash of them, with a hash of the PCs retired.
+ */
+typedef struct
+{
+    uint64_t hash;
+    size_t count;
+    size_t limit;   /* number of PCs retired */
+} pc_hash_t;
+
+static void hash_pc(
+    pc_hash_t * const hash,
+    const uint64_t pc)
+{
+    if (hash->count < hash->limit)
+    {
+        hash->hash = (hash->hash ^ pc) * UINT64_C(0x100000001b3);
+        hash->count++;
+    }
+}
+
+static void advance_decoded_pc(
+    void * const user_data,
+    const te_address_t old_pc,
+    const te_address_t new_pc,
+    const te_decoded_instruction_t * const new_instruction)
+{
+    (void)old_pc;
+    (void)new_instruction;
+
+    hash_pc((pc_hash_t *)user_data, new_pc);
+}
+
+static unsigned get_instruction(
+    void * const user_data,
+    const te_address_t address,
+    rv_inst * const instruction)
+{
+    (void)user_data;
+
+    const uint64_t index = (address - IMAGE_BASE) / 4u;
+    *instruction = (index < sizeof(image) / sizeof(image[0])) ? image[index] : 0u;
+
+    return 4u;
+}
+
+
+/*
+ * return the current (monotonic) time, in seconds
+ */
+static double get_seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+
+/*
+ * Run the program for "num_instructions" instructions, encoding each
+ * with the given options, and return the hash of the PCs retired.
+ */
+static pc_hash_t encode_program(
+    const size_t num_instructions,
+    const te_options_t * const options)
+{
+    uint32_t x[32] = {0};
+    uint32_t pc = IMAGE_BASE;
+    uint32_t last_auipc_rd = ZERO;
+    te_instruction_record_t irecord;
+    pc_hash_t retired = { UINT64_C(0xcbf29ce484222325), 0, num_instructions };
+
+    num_packets = 0;
+
+    te_encoder_state_t * const encoder =
+        te_open_trace_encoder(NULL, emit_te_inst, NULL, NULL);
+    encoder->options = *options;
+    te_send_te_inst_sync_support(encoder, TE_QUAL_STATUS_NO_CHANGE);
+
+    for (size_t i = 0; i <= num_instructions; i++)
+    {
+        execute(x, &pc, &last_auipc_rd, &irecord);
+        if (i < num_instructions)
+        {
+            hash_pc(&retired, irecord.pc);
+        }
+        else
+        {
+            irecord.is_qualified = false;   /* the trace ends */
+        }
+        te_encode_one_irecord(encoder, &irecord);
+    }
+
+    te_close_trace_encoder(encoder);
+
+    return retired;
+}
+
+
+int main(
+    int argc,
+    char * argv[])
+{
+    uint32_t labels[LARGE_COPIES * COPY_LABELS] = {0};
+    size_t num_instructions = DEFAULT_INSTRUCTIONS;
+    size_t num_decoders = 1;
+    bool with_callback = true;
+    unsigned copies = 1;
+    int32_t depth = CALL_DEPTH;
+    bool unordered = false;
+    size_t num_numbers = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (0 == strcmp(argv[i], "-n"))
+        {
+            with_callback = false;
+        }
+        else if (0 == strcmp(argv[i], "-l"))
+        {
+            copies = LARGE_COPIES;
+        }
+        else if (0 == strcmp(argv[i], "-r"))
+        {
+            depth = DEEP_CALL_DEPTH;
+        }
+        else if (0 == strcmp(argv[i], "-u"))
+        {
+            unordered = true;
+        }
+        else if (0 == num_numbers++)
+        {
+            num_instructions = (size_t)strtoull(argv[i], NULL, 0);
+        }
+        else
+        {
+            num_decoders = (size_t)strtoull(argv[i], NULL, 0);
+        }
+    }
+    if ( (0 == num_instructions) || (0 == num_decoders) || (num_numbers > 2) )
+    {
+        fprintf(stderr, "usage: %s [instructions] [decoders] [-n] [-l] [-r] [-u]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    assemble(labels, copies, depth);
+    assemble(labels, copies, depth);
+
+#if !defined(TE_WITH_STATISTICS)
+    fprintf(stderr, "warning: without TE_WITH_STATISTICS, the number of "
+        "instructions decoded is not checked\n");
+#endif  /* TE_WITH_STATISTICS */
+
+    te_decoder_state_t ** const decoders = malloc(num_decoders * sizeof(te_decoder_state_t *));
+    pc_hash_t * const decoded = malloc(num_decoders * sizeof(pc_hash_t));
+    unordered_state_t * const states = (unordered) ?
+        malloc(num_decoders * sizeof(unordered_state_t)) :
+        NULL;
+    assert(decoders);
+    assert(decoded);
+    assert( (!unordered) || (states) );
+
+    double total = 0.0;
+    size_t num_errors = 0;
+
+    for (unsigned combination = 0; combination < 16u; combination++)
+    {
+        te_options_t options;
+        memset(&options, 0, sizeof(options));
+        options.implicit_return = !!(combination & 1u);
+        options.jump_target_cache = !!(combination & 2u);
+        options.branch_prediction = !!(combination & 4u);
+        options.full_address = !!(combination & 8u);
+
+        const pc_hash_t retired = encode_program(num_instructions, &options);
+
+        /* decode (untimed) with the reference, checking every PC */
+        pc_hash_t reference = { UINT64_C(0xcbf29ce484222325), 0, num_instructions };
+        te_decoder_state_t * const checker = te_open_trace_decoder(
+            NULL,
+            get_instruction,
+            NULL,
+            advance_decoded_pc,
+            &reference,
+            rv32);
+        checkpoint_t * const checkpoints = malloc(num_packets * sizeof(checkpoint_t));
+        assert(checkpoints);
+        for (size_t p = 0; p < num_packets; p++)
+        {
+            te_process_te_inst(checker, &packets[p]);
+            save_checkpoint(&checkpoints[p], checker);
+        }
+        bool okay =
+            (TE_ERROR_OKAY == checker->error_code) &&
+            (retired.count == reference.count) &&
+            (retired.hash == reference.hash);
+        te_close_trace_decoder(checker);
+
+        for (size_t d = 0; d < num_decoders; d++)
+        {
+            decoded[d].hash = UINT64_C(0xcbf29ce484222325);
+            decoded[d].count = 0;
+            decoded[d].limit = num_instructions;
+            decoders[d] = te_open_trace_decoder(
+                (states) ? &states[d].state : NULL,
+                get_instruction,
+                NULL,
+                (with_callback) ? advance_decoded_pc : NULL,
+                &decoded[d],
+                rv32);
+        }
+
+        /* pass each packet to each of the trace-decoders in turn */
+        size_t mismatches = 0;
+        const double start = get_seconds();
+        for (size_t p = 0; p < num_packets; p++)
+        {
+            for (size_t d = 0; d < num_decoders; d++)
+            {
+                te_process_te_inst(decoders[d], &packets[p]);
+                mismatches += (matches_checkpoint(&checkpoints[p], decoders[d])) ? 0u : 1u;
+            }
+        }
+        const double elapsed = get_seconds() - start;
+        total += elapsed;
+
+        okay = okay && (0 == mismatches);
+        free(checkpoints);
+        for (size_t d = 0; d < num_decoders; d++)
+        {
+            okay = okay &&
+                (TE_ERROR_OKAY == decoders[d]->error_code) &&
+                ( (!with_callback) ||
+                  ( (retired.count == decoded[d].count) &&
+                    (retired.hash == decoded[d].hash) ) );
+            te_close_trace_decoder(decoders[d]);
+        }
+        num_errors += (okay) ? 0u : 1u;
+
+        printf("options %c%c%c%c: %8zu packets, %7.1f M instructions/s, %6.2f ns/instruction%s\n",
+            options.implicit_return ? 'i' : '-',
+            options.jump_target_cache ? 'j' : '-',
+            options.branch_prediction ? 'b' : '-',
+            options.full_address ? 'f' : '-',
+            num_packets,
+            (double)(num_instructions * num_decoders) / elapsed * 1e-6,
+            elapsed / (double)(num_instructions * num_decoders) * 1e9,
+            (okay) ? "" : " (MISMATCH)");
+    }
+
+    printf("total: %.3f s to decode %zu x %zu instructions, x 16 combinations, %.2f ns/instruction\n",
+        total, num_decoders, num_instructions,
+        total / (double)(num_instructions * num_decoders * 16u) * 1e9);
+
+    free(decoders);
+    free(decoded);
+    free(states);
+    free(packets);
+
+    return (num_errors) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
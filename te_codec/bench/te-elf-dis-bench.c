@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2020 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+/*
+ * A stand-alone benchmark of reading an elf-dis file (the output
+ * of 'objdump -d'), and of looking up its disassembly lines by
+ * address with te_find_one_elf_dis_tuple(), for example over
+ * a large kernel image:
+ *
+ *  riscv64-unknown-elf-objdump -d vmlinux > vmlinux.dis
+ *  cc -std=gnu11 -O2 -DNDEBUG -I../src -o te-elf-dis-bench \
+ *      te-elf-dis-bench.c ../src/te-elf-dis.c ../src/te-memory.c -lpthread
+ *  ./te-elf-dis-bench vmlinux.dis [lookups]
+ *
+ * It reports the time to read the file (both by parsing the text, and
+ * from its index), the time to free it, and the number of lookups per second, for addresses
+ * chosen at random from the file, of which 1 in 8 are misses (one byte
+ * past a valid address). For comparison, the same lookups are also
+ * performed with a plain binary-chop over the array of tuples.
+ *
+ * Note: this writes the index of the elf-dis file (see
+ * te_write_elf_dis_index()), alongside it. Building with
+ * -DTE_ELF_DIS_DENSE_FACTOR=0u forces the Eytzinger search,
+ * even if the addresses are dense.
+ */
+
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "te-elf-dis.h"
+
+
+/* default number of lookups to time */
+#define DEFAULT_LOOKUPS     (16u * 1024u * 1024u)
+
+
+/*
+ * return the current (monotonic) time, in seconds
+ */
+static double get_seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+
+/*
+ * return a pseudo-random number (xorshift64*)
+ */
+static uint64_t get_random(
+    uint64_t * const state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * UINT64_C(0x2545f4914f6cdd1d);
+}
+
+
+/*
+ * the reference: a binary-chop over the (sorted) array of tuples
+ */
+static const te_elf_dis_tuple_t * binary_chop(
+    const te_elf_dis_file_t * const elf_dis,
+    const uint64_t address)
+{
+    const te_elf_dis_tuple_t * const tuples =
+        (const te_elf_dis_tuple_t *)(elf_dis->membuf.data);
+    size_t lo = 0;
+    size_t hi = elf_dis->num_tuples;
+
+    while (lo < hi)
+    {
+        const size_t mid = lo + (hi - lo) / 2u;
+
+        if (tuples[mid].address < address)
+        {
+            lo = mid + 1u;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return ( (lo < elf_dis->num_tuples) && (address == tuples[lo].address) ) ?
+        tuples + lo : NULL;
+}
+
+
+int main(
+    int argc,
+    char * argv[])
+{
+    te_elf_dis_file_t elf_dis;
+
+    if ( (argc < 2) || (argc > 3) )
+    {
+        fprintf(stderr, "usage: %s <elf-dis-file> [lookups]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const size_t num_lookups = (argc > 2) ?
+        (size_t)strtoull(argv[2], NULL, 0) : DEFAULT_LOOKUPS;
+
+    /* read it, write its index, and then read it again (from the index) */
+    const double start_parse = get_seconds();
+    if (te_read_one_elf_dis_file(&elf_dis, argv[1]))
+    {
+        fprintf(stderr, "ERROR: unable to read \"%s\"\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    const double parse = get_seconds() - start_parse;
+    const bool indexed = (0 == te_write_elf_dis_index(&elf_dis));
+    const double start_free = get_seconds();
+    te_free_one_elf_dis_file(&elf_dis);
+    const double release = get_seconds() - start_free;
+
+    const double start_index = get_seconds();
+    if (te_read_one_elf_dis_file(&elf_dis, argv[1]))
+    {
+        fprintf(stderr, "ERROR: unable to re-read \"%s\"\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    const double index = get_seconds() - start_index;
+
+    const size_t num_tuples = elf_dis.num_tuples;
+    const te_elf_dis_tuple_t * const tuples =
+        (const te_elf_dis_tuple_t *)(elf_dis.membuf.data);
+
+    printf("%s: %zu lines, %s search\n", argv[1], num_tuples,
+        (elf_dis.slots) ? "dense" : "Eytzinger");
+    printf("read: %.3f s parsing", parse);
+    if (indexed)
+    {
+        printf(", %.3f s from its index", index);
+    }
+    printf(", %.3f s to free\n", release);
+
+    if ( (0 == num_tuples) || (0 == num_lookups) )
+    {
+        te_free_one_elf_dis_file(&elf_dis);
+        return EXIT_SUCCESS;
+    }
+
+    /* choose the addresses to look up, and check both searches agree */
+    uint64_t * const addresses = malloc(num_lookups * sizeof(uint64_t));
+    uint64_t state = UINT64_C(0x9e3779b97f4a7c15);
+    size_t num_errors = 0;
+    assert(addresses);
+
+    for (size_t i = 0; i < num_lookups; i++)
+    {
+        const size_t k = (size_t)(get_random(&state) % num_tuples);
+        addresses[i] = tuples[k].address + ((7u == (i & 7u)) ? 1u : 0u);
+    }
+    for (size_t i = 0; i < num_lookups; i += 61u)
+    {
+        const te_elf_dis_tuple_t * const expected =
+            binary_chop(&elf_dis, addresses[i]);
+        const te_elf_dis_tuple_t * const found =
+            te_find_one_elf_dis_tuple(&elf_dis, addresses[i]);
+
+        if (expected != found)
+        {
+            num_errors++;
+        }
+    }
+
+    /* then time each search, over all the addresses */
+    size_t num_found = 0;
+    const double start_chop = get_seconds();
+    for (size_t i = 0; i < num_lookups; i++)
+    {
+        num_found += (NULL != binary_chop(&elf_dis, addresses[i]));
+    }
+    const double chop = get_seconds() - start_chop;
+
+    const double start_find = get_seconds();
+    for (size_t i = 0; i < num_lookups; i++)
+    {
+        num_found += (NULL != te_find_one_elf_dis_tuple(&elf_dis, addresses[i]));
+    }
+    const double find = get_seconds() - start_find;
+
+    printf("te_find_one_elf_dis_tuple(): %.1f M lookups/s\n",
+        (double)num_lookups / find * 1e-6);
+    printf("binary-chop:                 %.1f M lookups/s\n",
+        (double)num_lookups / chop * 1e-6);
+    printf("(%zu found, %zu mismatches)\n", num_found / 2u, num_errors);
+
+    free(addresses);
+    te_free_one_elf_dis_file(&elf_dis);
+
+    return (num_errors) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
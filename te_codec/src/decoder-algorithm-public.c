@@ -30,6 +30,7 @@
 #include <stdlib.h>
 #include "decoder-algorithm-public.h"
 #include "te-codec-utilities.h"
+#include "te-shared-image.h"
 
 
 /*
@@ -78,9 +79,58 @@ static const char * const error_messages[TE_ERROR_NUM_ERRORS] =
     [TE_ERROR_IMPLICT_EXCEPTION]    = "implicit exception mode is not currently supported",
     [TE_ERROR_NOT_FORMAT3]          = "expecting trace to start with a format 3 packet",
     [TE_ERROR_INVALID_PACKET]       = "invalid packet format",
+    [TE_ERROR_UNRESOLVED_BPRED]     = "branch predictor state is not yet known (deferred)",
 };
 
 
+/*
+ * The following structure holds one set of decode caches set aside for
+ * a context other than the current one. See TE_CONTEXT_CACHES.
+ * The fields mirror those of the same name in te_decoder_state_t.
+ */
+struct te_context_caches_t
+{
+    uint32_t context;           /* the context these caches belong to */
+    uint64_t last_used;         /* "context_changes" when set aside, 0 if never */
+    te_hot_instruction_t * decoded_cache;   /* NULL if never used */
+    te_decoded_instruction_t * cold_cache;
+    size_t cold_cache_slots;
+    te_basic_block_t * basic_block_cache;
+    te_cfg_node_t * cfg_cache;
+};
+
+
+/*
+ * The functions called for each instruction by follow_execution_path()
+ * are passed a "variant", which is a set of the following bits. Each
+ * of these functions is always inlined, and follow_execution_path() is
+ * instantiated once for each variant, so that the tests of these bits
+ * (which change, at most, once per te_inst packet) are resolved at
+ * compile-time. If a bit is clear, then that feature is disabled.
+ * If TE_VARIANT_DEBUG is set, then debug_flags is still tested.
+ */
+#define TE_VARIANT_IMPLICIT_RETURN      (1u<<0)     /* options.implicit_return */
+#define TE_VARIANT_BRANCH_PREDICTION    (1u<<1)     /* options.branch_prediction */
+#define TE_VARIANT_DEBUG                (1u<<2)     /* debug_stream != NULL */
+#define TE_NUM_VARIANTS                 (1u<<3)
+
+#define TE_ALWAYS_INLINE    inline __attribute__((always_inline))
+
+
+/*
+ * Return the current variant (a set of TE_VARIANT_* bits) to use.
+ */
+static unsigned get_variant(
+    const te_decoder_state_t * const decoder)
+{
+    assert(decoder);
+
+    return ((decoder->options.implicit_return)   ? TE_VARIANT_IMPLICIT_RETURN   : 0u) |
+           ((decoder->options.branch_prediction) ? TE_VARIANT_BRANCH_PREDICTION : 0u) |
+           ((decoder->debug_stream)              ? TE_VARIANT_DEBUG             : 0u);
+}
+
+
 /*
  * Process an unrecoverable error with the trace-decoder's algorithm.
  * This is indicative of a serious malfunction - this should never happen!
@@ -102,7 +152,7 @@ static const char * const error_messages[TE_ERROR_NUM_ERRORS] =
 static void unrecoverable_error(
     te_decoder_state_t * const decoder,
     const te_error_code_t error_code,
-    const te_decoded_instruction_t * const instr)
+    const te_hot_instruction_t * const instr)
 {
     assert(decoder);
     assert(TE_ERROR_OKAY == decoder->error_code);
@@ -117,7 +167,9 @@ static void unrecoverable_error(
     if (instr)
     {
         fprintf(stderr, "Whilst processing the following instruction:\n");
-        fprintf(stderr, "%12" PRIx64 ":\t%s\n", instr->decode.pc, instr->line);
+        fprintf(stderr, "%12" PRIx64 ":\t%s\n",
+            instr->pc,
+            te_get_decoded_instr(decoder, instr->pc)->line);
     }
 
     fflush(stderr);
@@ -126,66 +178,168 @@ static void unrecoverable_error(
 }
 
 
+/*
+ * Calculate the set of classes (te_instruction_class_t) to which
+ * the instruction in the hot record "hot" belongs.
+ *
+ * This is the only place where the opcode and registers are examined,
+ * so that the predicates (e.g. is_branch()) are each just a single
+ * bit-wise AND, no matter how many times each instruction is seen.
+ */
+static uint8_t classify_instruction(
+    const te_hot_instruction_t * const hot)
+{
+    unsigned classes = 0;
+
+    assert(hot);
+
+    switch (hot->op)
+    {
+        case rv_op_beq:
+        case rv_op_bne:
+        case rv_op_blt:
+        case rv_op_bge:
+        case rv_op_bltu:
+        case rv_op_bgeu:
+        case rv_op_c_beqz:
+        case rv_op_c_bnez:
+            classes = TE_CLASS_BRANCH;
+            break;
+
+        case rv_op_jal:
+            classes = TE_CLASS_INFERRABLE_JUMP;
+            if (1 == hot->rd)
+            {
+                classes |= TE_CLASS_CALL;
+            }
+            break;
+
+        case rv_op_c_jal:
+            classes = TE_CLASS_INFERRABLE_JUMP | TE_CLASS_CALL;
+            break;
+
+        case rv_op_c_j:
+            classes = TE_CLASS_INFERRABLE_JUMP;
+            break;
+
+        case rv_op_jalr:
+            if (0 == hot->rs1)
+            {
+                classes = TE_CLASS_INFERRABLE_JUMP;
+            }
+            else
+            {
+                classes = TE_CLASS_UNINFERRABLE_JUMP | TE_CLASS_UNINFERRABLE_DISCON;
+            }
+            if (1 == hot->rd)
+            {
+                classes |= TE_CLASS_CALL;
+            }
+            if ( (1 == hot->rs1) && (0 == hot->rd) )
+            {
+                classes |= TE_CLASS_RETURN;
+            }
+            break;
+
+        case rv_op_c_jalr:
+            classes = TE_CLASS_UNINFERRABLE_JUMP | TE_CLASS_UNINFERRABLE_DISCON |
+                      TE_CLASS_CALL;
+            break;
+
+        case rv_op_c_jr:
+            classes = TE_CLASS_UNINFERRABLE_JUMP | TE_CLASS_UNINFERRABLE_DISCON;
+            if (1 == hot->rs1)
+            {
+                classes |= TE_CLASS_RETURN;
+            }
+            break;
+
+        /*
+         * Note: The exception reporting mechanism means it is not necessary
+         * to include ECALL, EBREAK or C.EBREAK as uninferrable discontinuities
+         */
+        case rv_op_uret:
+        case rv_op_sret:
+        case rv_op_mret:
+        case rv_op_dret:
+            classes = TE_CLASS_UNINFERRABLE_DISCON;
+            break;
+
+        case rv_op_auipc:
+            classes = TE_CLASS_UPPER_IMMEDIATE | TE_CLASS_AUIPC;
+            break;
+
+        case rv_op_lui:
+        case rv_op_c_lui:
+            classes = TE_CLASS_UPPER_IMMEDIATE;
+            break;
+
+        default:
+            break;  /* a sequential instruction */
+    }
+
+    return (uint8_t)classes;
+}
+
+
+/*
+ * Return the set of classes (te_instruction_class_t) of the instruction
+ * in the hot record "instr". If TE_WITHOUT_INSTRUCTION_CLASSES is defined,
+ * then these are re-calculated (by switching on the opcode) each time, as
+ * the predicates did originally, rather than those calculated once, when
+ * the record was inserted. This is only useful to measure the difference.
+ */
+static uint8_t get_classes(
+    const te_hot_instruction_t * const instr)
+{
+#if defined(TE_WITHOUT_INSTRUCTION_CLASSES)
+    return classify_instruction(instr);
+#else   /* TE_WITHOUT_INSTRUCTION_CLASSES */
+    return instr->classes;
+#endif  /* TE_WITHOUT_INSTRUCTION_CLASSES */
+}
+
+
 /*
  * for the address given, find the raw binary value of the instruction at
  * that address (using the function decoder->get_instruction), and then use
- * the open-source riscv-disassembler library to decode, and then cache it.
+ * the open-source riscv-disassembler library to decode it into "instr".
  */
-#define get_instr te_get_and_disassemble_instr  /* alias the function */
-te_decoded_instruction_t * te_get_and_disassemble_instr(
+static void fetch_and_decode(
     te_decoder_state_t * const decoder,
     const te_address_t address,
     te_decoded_instruction_t * const instr)
 {
-    const size_t slot = TE_SLOT_NUMBER(address);
     rv_inst instruction = 0;
     unsigned length;
 
     assert(decoder);
-    assert(decoder->get_instruction);
+    assert(decoder->get_instruction || decoder->get_context_instruction);
     assert(instr);
-    assert(TE_SENTINEL_BAD_ADDRESS != address);
-
-#if defined(TE_WITH_STATISTICS)
-    decoder->num_gets++;        /* update statistics */
-#endif  /* TE_WITH_STATISTICS */
 
-    /*
-     * if the address matches the decoded one passed in ...
-     * ... then just return it! Nothing to do this time!
-     */
-    if ( (instr->decode.pc == address) )
+    /* first, get the raw instruction (and its length), from its address */
+    if (decoder->get_context_instruction)
     {
-#if defined(TE_WITH_STATISTICS)
-        decoder->num_same++;        /* update statistics */
-#endif  /* TE_WITH_STATISTICS */
-        return instr;       /* referenced data is unchanged */
+        length = (decoder->get_context_instruction)(
+            decoder->user_data,
+            decoder->context,
+            address,
+            &instruction);
     }
-
-    /* is "address" currently in our decoded cache ? */
-    if (decoder->decoded_cache[slot].decode.pc == address)
+    else
     {
-#if defined(TE_WITH_STATISTICS)
-        decoder->num_hits++;        /* update statistics */
-#endif  /* TE_WITH_STATISTICS */
-        /* copy, and return the cached decode */
-        *instr = decoder->decoded_cache[slot];
-        return instr;       /* referenced data is updated */
+        length = (decoder->get_instruction)(
+            decoder->user_data,
+            address,
+            &instruction);
     }
 
-    /* otherwise, we need to do a bit of disassembly work ... */
-
-    /* first, get the raw instruction (and its length), from its address */
-    length = (decoder->get_instruction)(
-        decoder->user_data,
-        address,
-        &instruction);
-
     assert( (4 == length) ||
             (2 == length) );
 
     /* cache the length of the instruction, for instruction_size() */
     instr->length = length;
+    instr->custom = false;
 
     /*
      * Use the modified riscv-disassembler open-source library to decode
@@ -224,649 +378,2047 @@ te_decoded_instruction_t * te_get_and_disassemble_instr(
             decoder->user_data,
             instr);
     }
-
-    /* save the freshly decoded instruction in the decoded cache */
-    decoder->decoded_cache[slot] = *instr;
-
-    /*
-     * finally, return the pointer to te_decoded_instruction_t passed in, whose
-     * referenced data will have been updated (in situ), and
-     * added to the decoded_cache[] cache.
-     */
-    return instr;
 }
 
 
 /*
- * Returns the size of the instruction in bytes
- * Only safe to be called after get_instr() with instr
+ * for the address given, return its complete decode, from the cold_cache[]
+ * array, or (on a miss) by calling fetch_and_decode(), and then cache it.
+ * This is as te_get_decoded_instr(), but it never grows the cold_cache[],
+ * so it is used when only the hot record will be retained.
  */
-static unsigned instruction_size(
-    const te_decoded_instruction_t * const instr)
+static te_decoded_instruction_t * get_cold_instr(
+    te_decoder_state_t * const decoder,
+    const te_address_t address)
 {
-    assert(instr);
+    assert(decoder);
+    assert(decoder->get_instruction || decoder->get_context_instruction);
+    assert(TE_SENTINEL_BAD_ADDRESS != address);
 
-    return instr->length;
+    const size_t slot = (size_t)(address >> 1) & (decoder->cold_cache_slots - 1u);
+    te_decoded_instruction_t * const instr = &decoder->cold_cache[slot];
+
+#if defined(TE_WITH_STATISTICS)
+    decoder->num_cold_gets++;   /* update statistics */
+#endif  /* TE_WITH_STATISTICS */
+
+    /* is "address" currently in our cold cache ? */
+    if (instr->decode.pc == address)
+    {
+#if defined(TE_WITH_STATISTICS)
+        decoder->num_cold_hits++;   /* update statistics */
+#endif  /* TE_WITH_STATISTICS */
+        return instr;       /* return the cached decode */
+    }
+
+    /*
+     * otherwise, we need to do a bit of disassembly work ...
+     * but first, pass on any batched PCs, which may point to "instr".
+     */
+    if (decoder->pc_batch_count)
+    {
+        te_flush_decoded_pcs(decoder);
+    }
+    fetch_and_decode(decoder, address, instr);
+
+    /*
+     * finally, return the pointer to the freshly decoded
+     * instruction, which is now in the cold_cache[] cache.
+     */
+    return instr;
 }
 
 
 /*
- * Note, this function does not calculate nor even update the PC.
- * It is merely a single control point that should be called
- * each time the PC is updated, so we can inspect, check and record
- * each and every transition of the PC in a consistent manner.
- * This helps with checking the correctness of the decoder.
- *
- * Ultimately, the main purpose of this function is to call-back the
- * function-pointer decoder->advance_decoded_pc, to disseminate
- * the new value of the PC.
+ * Replace the cold_cache[] for the current context, with an empty one
+ * of cold_cache_observed_slots slots. Any batched PCs are passed on
+ * first, as they point into the cold_cache[] being replaced.
  */
-static void disseminate_pc(
+static void grow_cold_cache(
     te_decoder_state_t * const decoder)
 {
-    te_decoded_instruction_t instr = { .decode.pc = TE_SENTINEL_BAD_ADDRESS };
-
     assert(decoder);
+    assert(decoder->cold_cache_observed_slots > decoder->cold_cache_slots);
 
-    /* do some sanity checks ... just in case! */
-    assert(TE_SENTINEL_BAD_ADDRESS != decoder->pc);
-#if defined(TE_WITH_STATISTICS)
-    if (decoder->statistics.num_instructions)
+    if (decoder->pc_batch_count)
     {
-        /* it is NOT the first transition */
-        assert(TE_SENTINEL_BAD_ADDRESS != decoder->last_pc);
+        te_flush_decoded_pcs(decoder);
     }
-    else
+
+    free(decoder->cold_cache);
+    decoder->cold_cache_slots = decoder->cold_cache_observed_slots;
+    decoder->cold_cache = malloc(decoder->cold_cache_slots * sizeof(te_decoded_instruction_t));
+    assert(decoder->cold_cache);
+    for (size_t i = 0; i < decoder->cold_cache_slots; i++)
     {
-        /* it is the FIRST transition */
-        assert(TE_SENTINEL_BAD_ADDRESS == decoder->last_pc);
+        decoder->cold_cache[i].decode.pc = TE_SENTINEL_BAD_ADDRESS;
     }
-#endif  /* TE_WITH_STATISTICS */
+}
 
-    /* decode & disassemble the instruction at the new PC */
-    (void)get_instr(decoder, decoder->pc, &instr);
 
-    /* optionally show the transition & instruction at the new PC */
-    if ((decoder->debug_stream) && (decoder->debug_flags & TE_DEBUG_PC_TRANSITIONS))
-    {
-        fprintf(decoder->debug_stream,
-            "%s\t[%2" PRIu64 "] set_pc %8" PRIx64 " -> %8" PRIx64 ":\t%s\n",
-            (decoder->pc == decoder->last_sent_addr) ? "---->" : "",
-            decoder->branches,
-            decoder->last_pc,
-            decoder->pc,
-            instr.line);
-    }
+/*
+ * for the address given, return its complete decode, from the cold_cache[]
+ * array, or (on a miss) by calling fetch_and_decode(), and then cache it.
+ * The first call (in each context) grows the cold_cache[], unless its size
+ * was fixed when opened (see the comment for TE_OBSERVED_COLD_CACHE_BITS).
+ *
+ * This returns a pointer directly into the cold_cache[] array, so there
+ * is no copying at all. The pointer itself remains valid for the lifetime
+ * of the decoder, however the referenced entry will be replaced by any
+ * subsequent call for a different address which misses in the cache, and
+ * which maps to the same slot. Callers which need to look up more than
+ * one instruction at a time, should extract what they need from the first
+ * before looking up the second, or re-validate the first by checking that
+ * its "decode.pc" still matches the address they asked for.
+ */
+const te_decoded_instruction_t * te_get_decoded_instr(
+    te_decoder_state_t * const decoder,
+    const te_address_t address)
+{
+    assert(decoder);
 
-    /*
-     * notify the user that the PC has been updated
-     *
-     * Note: decoder->advance_decoded_pc may be NULL.
-     */
-    if (decoder->advance_decoded_pc)
+    if (decoder->cold_cache_slots < decoder->cold_cache_observed_slots)
     {
-        (decoder->advance_decoded_pc)(
-            decoder->user_data,
-            decoder->last_pc,
-            decoder->pc,
-            &instr);
+        grow_cold_cache(decoder);
     }
 
-    /* advance the count of PC transitions */
-#if defined(TE_WITH_STATISTICS)
-    decoder->statistics.num_instructions++;
-#endif  /* TE_WITH_STATISTICS */
+    return get_cold_instr(decoder, address);
 }
 
 
 /*
- * Determine if current instruction is a branch
+ * Copy the fields needed by the predicates from the complete decode
+ * "instr" into the compact hot record "hot", and classify it.
  */
-static bool is_branch(
+static void fill_hot_instr(
+    te_hot_instruction_t * const hot,
     const te_decoded_instruction_t * const instr)
 {
-    bool predicate = false;
-
+    assert(hot);
     assert(instr);
 
-    if ( (instr->decode.op == rv_op_beq)    ||
-         (instr->decode.op == rv_op_bne)    ||
-         (instr->decode.op == rv_op_blt)    ||
-         (instr->decode.op == rv_op_bge)    ||
-         (instr->decode.op == rv_op_bltu)   ||
-         (instr->decode.op == rv_op_bgeu)   ||
-         (instr->decode.op == rv_op_c_beqz) ||
-         (instr->decode.op == rv_op_c_bnez) )
-    {
-        predicate = true;
-    }
+    hot->pc = instr->decode.pc;
+    hot->imm = instr->decode.imm;
+    hot->op = instr->decode.op;
+    hot->rd = instr->decode.rd;
+    hot->rs1 = instr->decode.rs1;
+    hot->length = (uint8_t)instr->length;
+    hot->custom = instr->custom;
+    hot->classes = classify_instruction(hot);
+}
 
-    return predicate;
+
+/*
+ * Return a pointer to the first (most recently inserted) of the
+ * decoder->decoded_cache_ways records in the set for "address".
+ */
+static te_hot_instruction_t * get_hot_set(
+    te_decoder_state_t * const decoder,
+    const te_address_t address)
+{
+    const size_t set = (size_t)(address >> 1) & (decoder->decoded_cache_sets - 1u);
+
+    return &decoder->decoded_cache[set * decoder->decoded_cache_ways];
 }
 
 
 /*
- * Determine if current instruction is a branch, adjust the branch
- * count/map, and return the "taken" status
+ * Return the key used for the (optional) shared image, which is the
+ * user-chosen namespace (shared_context) in the upper 32 bits, and the
+ * current context (as reported in the te_inst packets) in the lower.
+ */
+static uint64_t get_shared_key(
+    const te_decoder_state_t * const decoder)
+{
+    return ((uint64_t)decoder->shared_context << 32) | decoder->context;
+}
+
+
+/*
+ * Return the predecoded range containing "address", or NULL if there
+ * is no such range. See te_predecode_image().
  *
- * If an unrecoverable error occurs, this function will immeditely
- * return false, if the function unrecoverable_error() returns.
+ * The range which satisfied the previous look-up is tried first,
+ * as the next look-up is very likely to be in the same range.
  */
-static bool is_taken_branch(
+static const te_predecoded_range_t * find_predecoded_range(
     te_decoder_state_t * const decoder,
-    const te_decoded_instruction_t * const instr)
+    const te_address_t address)
 {
-    bool taken = false;     /* assume branch not taken */
-    size_t bpred_index = 0;
-    bool predicted_outcome = false;
-    const char * source = NULL;
-
     assert(decoder);
-    assert(instr);
 
-    if (!is_branch(instr))
-    {
-        return false;
-    }
+    const te_predecoded_range_t * const ranges = decoder->predecoded;
+    const size_t last_hit = decoder->predecoded_hit;
 
-    if (0 == decoder->branches)
+    /* fast path: is it in the same range as last time ? */
+    if ( (last_hit < decoder->num_predecoded) &&
+         (((address - ranges[last_hit].base) >> 1) < ranges[last_hit].count) )
     {
-        unrecoverable_error(decoder, TE_ERROR_DEPLETED, instr);
-        return false;       /* return immediately if an unrecoverable error */
+        return &ranges[last_hit];
     }
 
-    /* this branch will be processed, decrement remaining branches */
-    decoder->branches--;
-
     /*
-     * retrieve the prediction from the branch predictor,
-     * if it is enabled.
+     * perform a binary-chop to find the last range whose
+     * base address is not beyond "address", if any.
      */
-    if (decoder->options.branch_prediction)
+    size_t lo = 0;
+    size_t hi = decoder->num_predecoded;
+
+    while (lo < hi)
     {
-        /* find the (direct-mapped) index into the branch predictor table */
-        bpred_index = te_get_bpred_index(instr->decode.pc, &decoder->discovery_response);
-        /* retrieve the extant state from the branch predictor table */
-        const te_bpred_state_t old_state =
-            (te_bpred_state_t)(decoder->bpred.table[bpred_index]);
-        /* decode the predicted state */
-        predicted_outcome = !!(old_state & 0x2u);
+        const size_t mid = lo + ((hi - lo) >> 1);
+
+        if (ranges[mid].base <= address)
+        {
+            lo = mid + 1u;  /* use the upper half */
+        }
+        else
+        {
+            hi = mid;       /* use the lower half */
+        }
     }
 
-    /*
-     * work out if the current branch will be taken or not ...
-     *
-     * This can come from several different sources!
-     * e.g. if we are using a branch-count, then use that and not
-     * the branch-map to determine if the branch is taken or not.
-     */
-    assert(!decoder->bpred.use_bmap_first || !decoder->bpred.miss_predict_carry_in);
-    if (decoder->bpred.use_bmap_first)
+    if ( (lo) &&
+         (((address - ranges[lo - 1u].base) >> 1) < ranges[lo - 1u].count) )
     {
-        /* the branch_map still has one valid bit to be consumed */
-        taken = !(decoder->branch_map & 1);  /* bit [0] */
-        decoder->branch_map >>= 1;   /* right-shift one bit */
-        decoder->bpred.use_bmap_first = false;
-        source = "bmap[0]";
+        decoder->predecoded_hit = lo - 1u;
+        return &ranges[lo - 1u];
     }
-    else if (decoder->bpred.miss_predict_carry_in)
+
+    return NULL;    /* not in any range */
+}
+
+
+/*
+ * As te_get_decoded_instr(), but return a pointer to the compact hot
+ * record for "address" in the decoded_cache[] array. This is all that
+ * is needed to follow the execution path, so the cold_cache[] is only
+ * used when the hot record is not already present. The lifetime of the
+ * pointer returned is the same as for te_get_decoded_instr(), except
+ * that the referenced record may be replaced by any miss in the same
+ * set, so callers should re-validate it by checking "pc" instead.
+ *
+ * The decoded_cache[] is set-associative, with each set holding its
+ * records in the order in which they were inserted. On a miss, the
+ * records in the set are each moved down one place (evicting the
+ * oldest), and the new record is inserted first. That is, the
+ * replacement policy is FIFO, which requires no extra state at all.
+ */
+static const te_hot_instruction_t * get_instr(
+    te_decoder_state_t * const decoder,
+    const te_address_t address)
+{
+    assert(decoder);
+    assert(decoder->decoded_cache);
+    assert(TE_SENTINEL_BAD_ADDRESS != address);
+
+    te_hot_instruction_t * const set = get_hot_set(decoder, address);
+    const unsigned ways = decoder->decoded_cache_ways;
+
+#if defined(TE_WITH_STATISTICS)
+    decoder->num_gets++;        /* update statistics */
+#endif  /* TE_WITH_STATISTICS */
+
+    /* is "address" in one of the (optional) predecoded ranges ? */
+    const te_predecoded_range_t * const range = (decoder->num_predecoded) ?
+        find_predecoded_range(decoder, address) :
+        NULL;
+    if (range)
     {
-        /* this branch is a miss-predict from the previous packet */
-        taken = !predicted_outcome; /* miss-prediction */
-        decoder->bpred.miss_predict_carry_in = false;
-        source = "carry-in";
+        te_hot_instruction_t * const hot = &range->records[(address - range->base) >> 1];
+        if (hot->pc == address)
+        {
+#if defined(TE_WITH_STATISTICS)
+            decoder->num_hits++;    /* update statistics */
+#endif  /* TE_WITH_STATISTICS */
+            return hot;
+        }
+        /* not yet decoded, so decode it now, as it is being used */
+        fill_hot_instr(hot, get_cold_instr(decoder, address));
+        return hot;
     }
-    else if (decoder->bpred.correct_predictions)
+
+    /* is "address" currently in our decoded cache ? */
+    for (unsigned way = 0; way < ways; way++)
     {
-        /* use the branch predictor for the next branch */
-        taken = predicted_outcome;  /* correct prediction */
-        source = "bpred";
+        if (set[way].pc == address)
+        {
+#if defined(TE_WITH_STATISTICS)
+            decoder->num_hits++;        /* update statistics */
+#endif  /* TE_WITH_STATISTICS */
+            return &set[way];   /* return the cached decode */
+        }
     }
-    else
+
+    /* otherwise, is it in the (optional) shared image ? */
+    const te_hot_instruction_t * const shared = (decoder->shared_image) ?
+        te_find_shared_instr(decoder->shared_image, get_shared_key(decoder), address) :
+        NULL;
+
+    /* if not, get the complete decode, via the cold cache */
+    const te_decoded_instruction_t * const instr = (shared) ?
+        NULL :
+        get_cold_instr(decoder, address);
+
+    /* make room for it, evicting the oldest record in the set */
+#if defined(TE_WITH_STATISTICS)
+    if (TE_SENTINEL_BAD_ADDRESS != set[ways - 1u].pc)
     {
-        /* use and then shift the branch-map[] */
-        taken = !(decoder->branch_map & 1);  /* bit [0] */
-        decoder->branch_map >>= 1;   /* right-shift one bit */
-        source = "bmap";
+        decoder->num_conflicts++;   /* update statistics */
+    }
+#endif  /* TE_WITH_STATISTICS */
+    memmove(&set[1], &set[0], (ways - 1u) * sizeof(*set));
+
+    if (shared)
+    {
+#if defined(TE_WITH_STATISTICS)
+        decoder->num_shared_hits++; /* update statistics */
+#endif  /* TE_WITH_STATISTICS */
+        set[0] = *shared;
+        return &set[0];
+    }
+
+    /* copy the fields needed by the predicates into the hot record */
+    fill_hot_instr(&set[0], instr);
+
+    /* and share it with all the other users of the shared image */
+    if (decoder->shared_image)
+    {
+        te_insert_shared_instr(decoder->shared_image, get_shared_key(decoder), &set[0]);
+    }
+
+    return &set[0];
+}
+
+
+/*
+ * Release all the predecoded ranges in "predecoded" (of "count" ranges).
+ */
+static void free_predecoded_ranges(
+    te_predecoded_range_t * const predecoded,
+    const size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        free(predecoded[i].records);
+    }
+    free(predecoded);
+}
+
+
+/*
+ * Predecode every half-word aligned address in the image of "size"
+ * bytes, starting at address "base", typically an executable (text)
+ * section of an ELF file. Thereafter, get_instr() will find the hot
+ * record for any address in the image with a single indexed load,
+ * and will call get_instruction at most once for each such address.
+ * This may be called once for each of several (non-overlapping) ranges,
+ * which are all retained (in address order), until the trace-decoder
+ * is closed. If there are several ranges, then get_instr() first
+ * tries the range it used last, and otherwise performs a binary-chop.
+ *
+ * Unlike the decode caches, the predecoded ranges are not set aside when
+ * the context changes, but apply to all contexts, much like a mapping
+ * with "all_contexts" in te-address-space.h. So, each image should be
+ * the same in every context (e.g. a kernel, or a shared library), even
+ * though its instructions are fetched for the current context (and
+ * those not decoded now, for whichever context is current when used).
+ *
+ * Each half-word costs one te_hot_instruction_t, and some of these will
+ * be the (unused) decodes of the 2nd half of 32-bit instructions, so
+ * get_instruction must be able to read 4 bytes at every half-word,
+ * bar the last one, which (like any record for a custom instruction)
+ * is only decoded when it is first used. If decoder->do_custom_instruction
+ * is assigned, then no record is decoded until it is first used, so that
+ * it is never called at an address which is not that of an instruction.
+ */
+void te_predecode_image(
+    te_decoder_state_t * const decoder,
+    const te_address_t base,
+    const size_t size)
+{
+    te_decoded_instruction_t instr;
+
+    assert(decoder);
+    assert(0 == (base & 1u));
+
+    const size_t count = size >> 1;
+    if (0 == count)
+    {
+        return;     /* nothing to do */
     }
 
+    te_hot_instruction_t * const records =
+        malloc(count * sizeof(te_hot_instruction_t));
+    assert(records);
+
     /*
-     * update the branch prediction lookup table, for the branch predictor,
-     * if it is enabled.
+     * the last half-word is not decoded now, as it may be the first half
+     * of a 32-bit instruction, whose second half is beyond the image.
      */
-    if (decoder->options.branch_prediction)
+    const size_t num_decoded = (decoder->do_custom_instruction) ? 0 : (count - 1u);
+    for (size_t i = 0; i < count; i++)
     {
-        /* retrieve the extant state from the branch predictor table */
-        const te_bpred_state_t old_state =
-            (te_bpred_state_t)(decoder->bpred.table[bpred_index]);
-        /* calculate the next value of the branch predictor state */
-        const te_bpred_state_t new_state = te_next_bpred_state(old_state, taken);
+        if (i < num_decoded)
+        {
+            fetch_and_decode(decoder, base + (te_address_t)(i << 1), &instr);
+            fill_hot_instr(&records[i], &instr);
+        }
+        else
+        {
+            records[i].pc = TE_SENTINEL_BAD_ADDRESS;    /* decoded when used */
+        }
+    }
 
-        /* optionally, print out what we have done */
-        if ( (decoder->debug_stream) &&
-             (decoder->debug_flags & TE_DEBUG_BRANCH_PREDICTION) )
+    /* insert the new range, keeping all the ranges in address order */
+    decoder->predecoded = realloc(decoder->predecoded,
+        (decoder->num_predecoded + 1u) * sizeof(te_predecoded_range_t));
+    assert(decoder->predecoded);
+    size_t index = decoder->num_predecoded;
+    while ( (index) && (decoder->predecoded[index - 1u].base > base) )
+    {
+        index--;
+    }
+    assert( (0 == index) ||
+            (decoder->predecoded[index - 1u].base +
+                (decoder->predecoded[index - 1u].count << 1) <= base) );
+    assert( (decoder->num_predecoded == index) ||
+            (base + (count << 1) <= decoder->predecoded[index].base) );
+    memmove(&decoder->predecoded[index + 1u],
+        &decoder->predecoded[index],
+        (decoder->num_predecoded - index) * sizeof(te_predecoded_range_t));
+    decoder->num_predecoded++;
+    te_predecoded_range_t * const range = &decoder->predecoded[index];
+    range->base = base;
+    range->count = count;
+    range->records = records;
+}
+
+
+/*
+ * As te_get_decoded_instr(), but copy the decoded instruction into
+ * the structure "instr" passed in, unless it already holds the
+ * decode for "address". The copy is owned by the caller.
+ */
+te_decoded_instruction_t * te_get_and_disassemble_instr(
+    te_decoder_state_t * const decoder,
+    const te_address_t address,
+    te_decoded_instruction_t * const instr)
+{
+    assert(decoder);
+    assert(instr);
+
+    /*
+     * if the address matches the decoded one passed in ...
+     * ... then just return it! Nothing to do this time!
+     */
+    if ( (instr->decode.pc == address) )
+    {
+#if defined(TE_WITH_STATISTICS)
+        decoder->num_gets++;        /* update statistics */
+        decoder->num_same++;        /* update statistics */
+#endif  /* TE_WITH_STATISTICS */
+        return instr;       /* referenced data is unchanged */
+    }
+
+    /* copy, and return the cached decode */
+    *instr = *te_get_decoded_instr(decoder, address);
+
+    return instr;       /* referenced data is updated */
+}
+
+
+/*
+ * Pass all the PCs in the batch to decoder->advance_decoded_pcs,
+ * and empty the batch. This is done whenever the batch is full, at
+ * the end of each te_inst packet, before the context changes, and also
+ * before any entry in the cold_cache[] is replaced. Each "instr" in the
+ * batch points into the cold_cache[], and so is always valid for the
+ * duration of the call-back. As the cold_cache[] is only replaced on a
+ * miss, this is rarely before the batch is full.
+ *
+ * Note: the call-back must not call the decoder.
+ */
+void te_flush_decoded_pcs(
+    te_decoder_state_t * const decoder)
+{
+    assert(decoder);
+
+    const size_t count = decoder->pc_batch_count;
+
+    if (count)
+    {
+        assert(decoder->advance_decoded_pcs);
+        decoder->pc_batch_count = 0;    /* empty it first, in case of re-entry */
+        (decoder->advance_decoded_pcs)(
+            decoder->user_data,
+            decoder->pc_batch,
+            count);
+    }
+}
+
+
+/*
+ * Pass the current run of sequential PCs (if any) to the call-back
+ * decoder->advance_decoded_run, with "end" recording how it ended.
+ */
+static void end_decoded_run(
+    te_decoder_state_t * const decoder,
+    const te_run_end_t end)
+{
+    assert(decoder);
+
+    if (decoder->run.count)
+    {
+        assert(decoder->advance_decoded_run);
+        decoder->run.end = end;
+        (decoder->advance_decoded_run)(
+            decoder->user_data,
+            &decoder->run);
+        decoder->run.count = 0;
+    }
+}
+
+
+/*
+ * Append a sequential segment of "count" PCs, from "first_pc" to
+ * "last_pc" (inclusive), to the current run of sequential PCs.
+ * If the segment does not follow on sequentially from the current
+ * run, then the current run has ended, so it is passed to the user,
+ * and a new run is started. The address following "last_pc" is given
+ * as "next_pc", and "classes" are the classes of its instruction.
+ */
+static void append_decoded_run(
+    te_decoder_state_t * const decoder,
+    const te_address_t first_pc,
+    const te_address_t last_pc,
+    const uint64_t count,
+    const te_address_t next_pc,
+    const uint8_t classes)
+{
+    assert(decoder);
+
+    if ( (decoder->run.count) && (decoder->run_next_pc != first_pc) )
+    {
+        /* the current run ended with a discontinuity, of what kind ? */
+        te_run_end_t end = TE_RUN_END_OTHER;
+        if (decoder->run_last_classes & TE_CLASS_BRANCH)
         {
-            const bool previous_outcome = !!(old_state & 0x1u);
-            fprintf(decoder->debug_stream,
-                "bpred-%u: %" PRIx64 ", bpred_table[%02" PRIx64 "] = %d%d -> %d%d,"
-                "  branches = %2" PRIu64 ",  %-8s  %-9s  %s\n",
-                ++decoder->bpred.serial,
-                instr->decode.pc,
-                bpred_index,
-                (predicted_outcome) ? 1 : 0,    /* MSB */
-                (previous_outcome)  ? 1 : 0,    /* LSB */
-                (new_state & 0x2u)  ? 1 : 0,    /* MSB */
-                (new_state & 0x1u)  ? 1 : 0,    /* LSB */
-                decoder->branches,
-                source,
-                taken ? "TAKEN" : "not taken",
-                (predicted_outcome == taken) ? "CORRECTLY PREDICATED" : "miss-predicted");
+            end = TE_RUN_END_TAKEN_BRANCH;
+        }
+        else if (decoder->run_last_classes & TE_CLASS_INFERRABLE_JUMP)
+        {
+            end = TE_RUN_END_JUMP;
+        }
+        else if (decoder->run_last_classes & TE_CLASS_UNINFERRABLE_DISCON)
+        {
+            end = TE_RUN_END_UNINFERRABLE;
         }
+        end_decoded_run(decoder, end);
+    }
 
-        /* finally update the lookup table with the new state */
-        decoder->bpred.table[bpred_index] = (uint8_t)new_state;
+    if (decoder->run.count)
+    {
+        decoder->run.last_pc = last_pc;
+        decoder->run.count += count;
+    }
+    else
+    {
+        decoder->run.first_pc = first_pc;
+        decoder->run.last_pc = last_pc;
+        decoder->run.count = count;
     }
 
-    return taken;
+    decoder->run_next_pc = next_pc;
+    decoder->run_last_classes = classes;
+}
+
+
+/*
+ * Pass the current run of sequential PCs (if any) to the call-back
+ * decoder->advance_decoded_run, even though it has not yet ended.
+ * Typically, this is called once, at the end of the trace.
+ */
+void te_flush_decoded_run(
+    te_decoder_state_t * const decoder)
+{
+    assert(decoder);
+
+    end_decoded_run(decoder, TE_RUN_END_FLUSH);
+}
+
+
+/*
+ * Returns the size of the instruction in bytes
+ * Only safe to be called after get_instr() with instr
+ */
+static unsigned instruction_size(
+    const te_hot_instruction_t * const instr)
+{
+    assert(instr);
+
+    return instr->length;
+}
+
+
+/*
+ * Note, this function does not calculate nor even update the PC.
+ * It is merely a single control point that should be called
+ * each time the PC is updated, so we can inspect, check and record
+ * each and every transition of the PC in a consistent manner.
+ * This helps with checking the correctness of the decoder.
+ *
+ * Ultimately, the main purpose of this function is to call-back the
+ * function-pointer decoder->advance_decoded_pc, to disseminate
+ * the new value of the PC.
+ */
+static TE_ALWAYS_INLINE void disseminate_pc(
+    te_decoder_state_t * const decoder,
+    const unsigned variant)
+{
+    const te_decoded_instruction_t * instr = NULL;
+
+    assert(decoder);
+
+    /* do some sanity checks ... just in case! */
+    assert(TE_SENTINEL_BAD_ADDRESS != decoder->pc);
+#if defined(TE_WITH_STATISTICS)
+    if (decoder->statistics.num_instructions)
+    {
+        /* it is NOT the first transition */
+        assert(TE_SENTINEL_BAD_ADDRESS != decoder->last_pc);
+    }
+    else
+    {
+        /* it is the FIRST transition */
+        assert(TE_SENTINEL_BAD_ADDRESS == decoder->last_pc);
+    }
+#endif  /* TE_WITH_STATISTICS */
+
+    /*
+     * decode & disassemble the instruction at the new PC ...
+     * ... but only if there is somebody interested in it!
+     */
+    const bool show_transition =
+        (variant & TE_VARIANT_DEBUG) && (decoder->debug_stream) && (decoder->debug_flags & TE_DEBUG_PC_TRANSITIONS);
+    if ( (show_transition) ||
+         (decoder->advance_decoded_pc) ||
+         (decoder->advance_decoded_pcs) )
+    {
+        instr = te_get_decoded_instr(decoder, decoder->pc);
+    }
+
+    /* optionally show the transition & instruction at the new PC */
+    if (show_transition)
+    {
+        fprintf(decoder->debug_stream,
+            "%s\t[%2" PRIu64 "] set_pc %8" PRIx64 " -> %8" PRIx64 ":\t%s\n",
+            (decoder->pc == decoder->last_sent_addr) ? "---->" : "",
+            decoder->branches,
+            decoder->last_pc,
+            decoder->pc,
+            instr->line);
+    }
+
+    /*
+     * notify the user that the PC has been updated
+     *
+     * Note: decoder->advance_decoded_pc may be NULL.
+     */
+    if (decoder->advance_decoded_pc)
+    {
+        (decoder->advance_decoded_pc)(
+            decoder->user_data,
+            decoder->last_pc,
+            decoder->pc,
+            instr);
+    }
+
+    /*
+     * or, append it to the batch, to notify the user later
+     *
+     * Note: decoder->advance_decoded_pcs may be NULL.
+     */
+    if (decoder->advance_decoded_pcs)
+    {
+        te_decoded_pc_t * const entry = &decoder->pc_batch[decoder->pc_batch_count++];
+        entry->old_pc = decoder->last_pc;
+        entry->new_pc = decoder->pc;
+        entry->instr = instr;
+        if (TE_PC_BATCH_SIZE == decoder->pc_batch_count)
+        {
+            te_flush_decoded_pcs(decoder);
+        }
+    }
+
+    /*
+     * or, append it to the current run, to notify the user later
+     *
+     * Note: decoder->advance_decoded_run may be NULL.
+     */
+    if (decoder->advance_decoded_run)
+    {
+        const te_hot_instruction_t * const hot = get_instr(decoder, decoder->pc);
+        append_decoded_run(decoder,
+            decoder->pc,
+            decoder->pc,
+            1u,
+            decoder->pc + hot->length,
+            get_classes(hot));
+    }
+
+    /* advance the count of PC transitions */
+#if defined(TE_WITH_STATISTICS)
+    decoder->statistics.num_instructions++;
+#endif  /* TE_WITH_STATISTICS */
+}
+
+
+/*
+ * Returns true if somebody wants to observe each and every PC.
+ */
+static TE_ALWAYS_INLINE bool is_each_pc_observed(
+    const te_decoder_state_t * const decoder,
+    const unsigned variant)
+{
+    assert(decoder);
+
+    return (decoder->advance_decoded_pc) ||
+           (decoder->advance_decoded_pcs) ||
+           ( (variant & TE_VARIANT_DEBUG) && (decoder->debug_stream) && (decoder->debug_flags & TE_DEBUG_PC_TRANSITIONS) );
+}
+
+
+/*
+ * Determine if current instruction is a branch
+ */
+static bool is_branch(
+    const te_hot_instruction_t * const instr)
+{
+    assert(instr);
+
+    return !!(get_classes(instr) & TE_CLASS_BRANCH);
+}
+
+
+/*
+ * Whilst the branch predictor is deferred (see te_defer_bpred_table()),
+ * each entry in bpred.table[] holds four 2-bit fields, where field "s"
+ * (bits [2s+1:2s]) is the state that the entry would now be in, if it
+ * had been in state "s" when it was deferred. Initially, this is the
+ * identity map. An entry is "resolved" once all four fields are equal,
+ * i.e. its state no longer depends on what it was when it was deferred.
+ */
+#define TE_BPRED_IDENTITY_MAP   (0xe4u)     /* 11 10 01 00 */
+
+static bool is_bpred_resolved(
+    const te_decoder_state_t * const decoder,
+    const uint8_t entry)
+{
+    return (!decoder->bpred_deferred) ||
+           (entry == (entry & 0x3u) * 0x55u);
+}
+
+static te_bpred_state_t get_bpred_state(
+    const te_decoder_state_t * const decoder,
+    const uint8_t entry)
+{
+    /* if deferred, this is only meaningful once resolved */
+    return (te_bpred_state_t)(decoder->bpred_deferred ? (entry & 0x3u) : entry);
+}
+
+static uint8_t next_bpred_entry(
+    const te_decoder_state_t * const decoder,
+    const uint8_t entry,
+    const bool taken)
+{
+    if (!decoder->bpred_deferred)
+    {
+        return (uint8_t)te_next_bpred_state((te_bpred_state_t)entry, taken);
+    }
+
+    uint8_t map = 0;
+    for (unsigned state = 0; state < 4u; state++)
+    {
+        const te_bpred_state_t old_state = (te_bpred_state_t)((entry >> (2u * state)) & 0x3u);
+        map |= (uint8_t)(te_next_bpred_state(old_state, taken) << (2u * state));
+    }
+
+    return map;
+}
+
+
+/*
+ * Defer the state of the branch predictor table, as if it were unknown.
+ *
+ * Thereafter, each packet is processed as normal, except that if the
+ * prediction for a branch is needed, and it depends on the (unknown)
+ * state of the table when it was deferred, then processing stops with
+ * decoder->error_code set to TE_ERROR_UNRESOLVED_BPRED. In which case,
+ * the packets must be processed again, once the table is known.
+ *
+ * This is used to start decoding part-way through a trace (e.g. at a
+ * synchronization packet), before the branch predictor is known, as the
+ * trace-encoder does not re-initialize its branch predictor on a sync.
+ */
+void te_defer_bpred_table(
+    te_decoder_state_t * const decoder)
+{
+    assert(decoder);
+
+    memset(decoder->bpred.table,
+        TE_BPRED_IDENTITY_MAP,
+        decoder->bpred.size);
+    decoder->bpred_deferred = true;
+}
+
+
+/*
+ * Resolve a copy of a deferred branch predictor table ("map", of "size"
+ * entries, see te_defer_bpred_table()), given the state it was in
+ * ("initial") when it was deferred. On return, "map" holds the actual
+ * state of each entry. This allows the table to be resolved after its
+ * trace-decoder has been closed.
+ */
+void te_resolve_bpred_map(
+    uint8_t * const map,
+    const size_t size,
+    const uint8_t * const initial)
+{
+    assert(map || !size);
+    assert(initial || !size);
+
+    for (size_t i = 0; i < size; i++)
+    {
+        assert(initial[i] <= TE_BPRED_11);
+        map[i] = (map[i] >> (2u * initial[i])) & 0x3u;
+    }
+}
+
+
+/*
+ * Resolve the branch predictor table, previously deferred with
+ * te_defer_bpred_table(), given the state it was in ("initial",
+ * of bpred.size entries) when it was deferred. Thereafter, the
+ * table is used as normal.
+ */
+void te_resolve_bpred_table(
+    te_decoder_state_t * const decoder,
+    const uint8_t * const initial)
+{
+    assert(decoder);
+    assert(initial);
+
+    if (!decoder->bpred_deferred)
+    {
+        return;     /* nothing to do */
+    }
+
+    te_resolve_bpred_map(decoder->bpred.table, decoder->bpred.size, initial);
+    decoder->bpred_deferred = false;
+}
+
+
+/*
+ * Determine if current instruction is a branch, adjust the branch
+ * count/map, and return the "taken" status
+ *
+ * If an unrecoverable error occurs, this function will immeditely
+ * return false, if the function unrecoverable_error() returns.
+ */
+static TE_ALWAYS_INLINE bool is_taken_branch(
+    te_decoder_state_t * const decoder,
+    const te_hot_instruction_t * const instr,
+    const unsigned variant)
+{
+    bool taken = false;     /* assume branch not taken */
+    size_t bpred_index = 0;
+    uint8_t old_entry = 0;
+    bool resolved = true;   /* true if the predicted outcome is known */
+    bool predicted_outcome = false;
+    bool predicted = false;     /* true if the branch predictor was used */
+    const char * source = NULL;
+
+    assert(decoder);
+    assert(instr);
+
+    if (!is_branch(instr))
+    {
+        return false;
+    }
+
+    if (0 == decoder->branches)
+    {
+        unrecoverable_error(decoder, TE_ERROR_DEPLETED, instr);
+        return false;       /* return immediately if an unrecoverable error */
+    }
+
+    /* this branch will be processed, decrement remaining branches */
+    decoder->branches--;
+
+    /*
+     * retrieve the prediction from the branch predictor,
+     * if it is enabled.
+     */
+    if (variant & TE_VARIANT_BRANCH_PREDICTION)
+    {
+        /* find the (direct-mapped) index into the branch predictor table */
+        bpred_index = te_get_bpred_index(instr->pc, &decoder->discovery_response);
+        /* retrieve the extant state from the branch predictor table */
+        old_entry = decoder->bpred.table[bpred_index];
+        const te_bpred_state_t old_state = get_bpred_state(decoder, old_entry);
+        resolved = is_bpred_resolved(decoder, old_entry);
+        /* decode the predicted state */
+        predicted_outcome = !!(old_state & 0x2u);
+    }
+
+    /*
+     * work out if the current branch will be taken or not ...
+     *
+     * This can come from several different sources!
+     * e.g. if we are using a branch-count, then use that and not
+     * the branch-map to determine if the branch is taken or not.
+     */
+    assert(!decoder->bpred.use_bmap_first || !decoder->bpred.miss_predict_carry_in);
+    if (decoder->bpred.use_bmap_first)
+    {
+        /* the branch_map still has one valid bit to be consumed */
+        taken = !(decoder->branch_map & 1);  /* bit [0] */
+        decoder->branch_map >>= 1;   /* right-shift one bit */
+        decoder->bpred.use_bmap_first = false;
+        source = "bmap[0]";
+    }
+    else if (!resolved &&
+             ( (decoder->bpred.miss_predict_carry_in) ||
+               (decoder->bpred.correct_predictions) ) )
+    {
+        /*
+         * The prediction is needed, but it depends on the state of the
+         * table when it was deferred, which is not yet known. This is
+         * not an error, so do not call unrecoverable_error(), but stop
+         * processing, as if it had returned.
+         */
+        decoder->error_code = TE_ERROR_UNRESOLVED_BPRED;
+        return false;
+    }
+    else if (decoder->bpred.miss_predict_carry_in)
+    {
+        /* this branch is a miss-predict from the previous packet */
+        taken = !predicted_outcome; /* miss-prediction */
+        decoder->bpred.miss_predict_carry_in = false;
+        source = "carry-in";
+    }
+    else if (decoder->bpred.correct_predictions)
+    {
+        /* use the branch predictor for the next branch */
+        taken = predicted_outcome;  /* correct prediction */
+        predicted = true;
+        source = "bpred";
+    }
+    else
+    {
+        /* use and then shift the branch-map[] */
+        taken = !(decoder->branch_map & 1);  /* bit [0] */
+        decoder->branch_map >>= 1;   /* right-shift one bit */
+        source = "bmap";
+    }
+
+    /* a loop may only be skipped, if every branch was correctly predicted */
+    if (!predicted)
+    {
+        decoder->loop.periodic = false;
+    }
+
+    /*
+     * update the branch prediction lookup table, for the branch predictor,
+     * if it is enabled.
+     */
+    if (variant & TE_VARIANT_BRANCH_PREDICTION)
+    {
+        /* retrieve the extant state from the branch predictor table */
+        const te_bpred_state_t old_state = get_bpred_state(decoder, old_entry);
+        /* calculate the next value of the branch predictor state */
+        const te_bpred_state_t new_state = te_next_bpred_state(old_state, taken);
+        const uint8_t new_entry = next_bpred_entry(decoder, old_entry, taken);
+
+        /* optionally, print out what we have done */
+        if ( (variant & TE_VARIANT_DEBUG) && (decoder->debug_stream) &&
+             (decoder->debug_flags & TE_DEBUG_BRANCH_PREDICTION) )
+        {
+            const bool previous_outcome = !!(old_state & 0x1u);
+            fprintf(decoder->debug_stream,
+                "bpred-%u: %" PRIx64 ", bpred_table[%02" PRIx64 "] = %d%d -> %d%d,"
+                "  branches = %2" PRIu64 ",  %-8s  %-9s  %s\n",
+                ++decoder->bpred.serial,
+                instr->pc,
+                bpred_index,
+                (predicted_outcome) ? 1 : 0,    /* MSB */
+                (previous_outcome)  ? 1 : 0,    /* LSB */
+                (new_state & 0x2u)  ? 1 : 0,    /* MSB */
+                (new_state & 0x1u)  ? 1 : 0,    /* LSB */
+                decoder->branches,
+                source,
+                taken ? "TAKEN" : "not taken",
+                (predicted_outcome == taken) ? "CORRECTLY PREDICATED" : "miss-predicted");
+        }
+
+        /* a loop may only be skipped, if this state is saturated */
+        if (new_entry != old_entry)
+        {
+            decoder->loop.periodic = false;
+        }
+
+        /* finally update the lookup table with the new state */
+        decoder->bpred.table[bpred_index] = new_entry;
+    }
+
+    return taken;
+}
+
+
+/*
+ * Determine if instruction is an inferrable jump
+ */
+static bool is_inferrable_jump(
+    const te_hot_instruction_t * const instr)
+{
+    assert(instr);
+
+    return !!(get_classes(instr) & TE_CLASS_INFERRABLE_JUMP);
+}
+
+
+/*
+ * Determine if instruction is an uninferrable jump
+ */
+static bool is_uninferrable_jump(
+    const te_hot_instruction_t * const instr)
+{
+    assert(instr);
+
+    return !!(get_classes(instr) & TE_CLASS_UNINFERRABLE_JUMP);
+}
+
+
+/*
+ * Determine if instruction is an uninferrable discontinuity
+ */
+static bool is_uninferrable_discon(
+    const te_hot_instruction_t * const instr)
+{
+    assert(instr);
+
+    /*
+     * Note: The exception reporting mechanism means it is not necessary
+     * to include ECALL, EBREAK or C.EBREAK in this predicate
+     */
+    return !!(get_classes(instr) & TE_CLASS_UNINFERRABLE_DISCON);
+}
+
+
+/*
+ * Determine if instruction may itself trap, that is an ECALL, an EBREAK
+ * (or C.EBREAK), an illegal instruction, or a custom instruction (whose
+ * behaviour is unknown). The instructions which follow one of these
+ * might never be executed, so they should not be fetched speculatively.
+ */
+static bool is_trap_instruction(
+    const te_hot_instruction_t * const instr)
+{
+    assert(instr);
+
+    if (instr->custom)
+    {
+        return true;
+    }
+
+    switch (instr->op)
+    {
+        case rv_op_illegal:
+        case rv_op_ecall:
+        case rv_op_ebreak:
+        case rv_op_c_ebreak:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+
+/*
+ * Determine if instruction is a sequentially inferrable jump
+ */
+static bool is_sequential_jump(
+    te_decoder_state_t * const decoder,
+    const te_hot_instruction_t * const instr,
+    const te_address_t prev_addr)
+{
+    bool predicate = false;
+
+    assert(decoder);
+    assert(instr);
+
+    if (!is_uninferrable_jump(instr))
+    {
+        return false;
+    }
+
+    /* take a copy, as the next line may evict "instr" from the decoded cache */
+    const uint8_t rs1 = instr->rs1;
+    const te_hot_instruction_t * const prev_instr = get_instr(decoder, prev_addr);
+
+    if (get_classes(prev_instr) & TE_CLASS_UPPER_IMMEDIATE)
+    {
+        predicate = (rs1 == prev_instr->rd);
+    }
+
+    return predicate;
+}
+
+
+/*
+ * Find the target of a sequentially inferrable jump
+ */
+static te_address_t sequential_jump_target(
+    te_decoder_state_t * const decoder,
+    const te_address_t addr,
+    const te_address_t prev_addr)
+{
+    te_address_t target = 0;
+
+    assert(decoder);
+
+    /* take copies, as the decoded cache entries may be evicted */
+    const te_hot_instruction_t * const instr = get_instr(decoder, addr);
+    const bool is_jalr = (instr->op == rv_op_jalr);
+    const int64_t imm2 = instr->imm;
+    const te_hot_instruction_t * const prev_instr = get_instr(decoder, prev_addr);
+
+    if (get_classes(prev_instr) & TE_CLASS_AUIPC)
+    {
+        target = prev_addr;
+    }
+
+    const int64_t imm = prev_instr->imm;
+    target += (te_address_t)imm;
+
+    if (is_jalr)
+    {
+        target += (te_address_t)imm2;
+    }
+
+    return target;
+}
+
+
+/*
+ * Determine if instruction is a call
+ * - excludes tail calls as they do not push an address onto the return stack
+ */
+static bool is_call(
+    const te_hot_instruction_t * const instr)
+{
+    assert(instr);
+
+    return !!(get_classes(instr) & TE_CLASS_CALL);
+}
+
+
+/*
+ * Determine if instruction return address can be implicitly inferred
+ */
+static TE_ALWAYS_INLINE bool is_implicit_return(
+    const te_decoder_state_t * const decoder,
+    const te_hot_instruction_t * const instr,
+    const te_inst_t * const te_inst,
+    const unsigned variant)
+{
+    bool predicate = false;
+    assert(decoder);
+    assert(instr);
+    assert(te_inst);
+
+    if (!(variant & TE_VARIANT_IMPLICIT_RETURN))
+    {
+        return false;   /* Implicit return mode is disabled */
+    }
+
+    /*
+     * In the following code the value of "te_inst->irfail" is
+     * not the value of the irfail bit physically transmitted
+     * in the te_inst packet. Instead it is a logical XOR
+     * that indicates if the irfail bit physically transmitted
+     * was different from the previously transmitted bit.
+     * See comment in the definition of "te_inst_t" for details.
+     */
+    if (get_classes(instr) & TE_CLASS_RETURN)
+    {
+        if ( (te_inst->irfail) &&
+             (te_inst->irdepth == decoder->irstack_depth) )
+        {
+            /* implicit return address prediction failed here */
+            predicate = false;
+        }
+        else
+        {
+            /* return true if the irstack is not empty */
+            predicate = (decoder->irstack_depth > 0);
+        }
+    }
+
+    return predicate;
+}
+
+
+/*
+ * Push address onto the implicit return stack
+ */
+static TE_ALWAYS_INLINE void push_return_stack(
+    te_decoder_state_t * const decoder,
+    const te_address_t address,
+    const unsigned variant)
+{
+    te_address_t link_reg = address;
+
+    assert(decoder);
+
+    if (!(variant & TE_VARIANT_IMPLICIT_RETURN))
+    {
+        return;     /* Implicit return mode is disabled */
+    }
+
+    /*
+     * The maximum depth is determined by whichever of the call-counter
+     * or the return-stack is implemented on the trace-encoder.
+     * See te_apply_discovery_response().
+     */
+    const size_t irstack_depth_max = decoder->return_stack_entries;
+    assert(decoder->irstack_depth <= irstack_depth_max);
+
+    if (irstack_depth_max == decoder->irstack_depth)
+    {
+        /*
+         * Delete oldest entry from irstack to make room for new entry added below.
+         * As the return_stack[] is circular, this is simply forgetting about it,
+         * and the new entry will (eventually) overwrite it.
+         */
+        decoder->irstack_depth--;
+    }
+
+    /* link register is address of next spatial instruction */
+    link_reg += instruction_size(get_instr(decoder, address));
+
+    /* optionally show what we will push onto the irstack */
+    if ((variant & TE_VARIANT_DEBUG) && (decoder->debug_stream) && (decoder->debug_flags & TE_DEBUG_IMPLICIT_RETURN))
+    {
+        fprintf(decoder->debug_stream,
+            "irstack: pushed [%3" PRIu64 "] <-- %08" PRIx64 "\n",
+            decoder->irstack_depth,
+            link_reg);
+    }
+
+    /* push link register to top of the irstack */
+    decoder->return_stack[decoder->irstack_top & (irstack_depth_max - 1u)] = link_reg;
+    decoder->irstack_top++;
+    decoder->irstack_depth++;
+}
+
+
+/*
+ * Pop address from the implicit return stack
+ */
+static TE_ALWAYS_INLINE te_address_t pop_return_stack(
+    te_decoder_state_t * const decoder,
+    const unsigned variant)
+{
+    assert(decoder);
+
+    /*
+     * Note: this function is not called if irstack_depth is 0,
+     * so no need to check for underflow
+     */
+    decoder->irstack_depth--;
+    decoder->irstack_top--;
+
+    const te_address_t link_reg =
+        decoder->return_stack[decoder->irstack_top & (decoder->return_stack_entries - 1u)];
+
+    /* optionally show what we will pop from the irstack */
+    if ((variant & TE_VARIANT_DEBUG) && (decoder->debug_stream) && (decoder->debug_flags & TE_DEBUG_IMPLICIT_RETURN))
+    {
+        fprintf(decoder->debug_stream,
+            "irstack: popped [%3" PRIu64 "] --> %08" PRIx64 "\n",
+            decoder->irstack_depth,
+            link_reg);
+    }
+
+    return link_reg;
+}
+
+
+/*
+ * Called after each branch at "this_pc" is followed (in next_pc()), to
+ * detect if the execution path has become periodic, in which case as
+ * many whole cycles as possible are skipped, in a single step, leaving
+ * at least two branches still to be processed. None of the checks for
+ * stopping in follow_execution_path() can be satisfied before then.
+ *
+ * The instructions in the skipped cycles are not disseminated. So, if
+ * somebody wants to observe every PC, the cycles are only skipped if
+ * decoder->loop_repeated has been provided, which is then called
+ * instead, to notify the user of the number of cycles skipped.
+ */
+static TE_ALWAYS_INLINE void accelerate_loop(
+    te_decoder_state_t * const decoder,
+    const te_address_t this_pc,
+    const bool taken,
+    const unsigned variant)
+{
+    te_loop_t * const loop = &decoder->loop;
+
+    assert(decoder);
+
+    loop->length++;
+    if (taken)
+    {
+        loop->taken++;
+    }
+
+    if ( (loop->anchor == this_pc) && (loop->periodic) )
+    {
+        /* back at the anchor, with nothing changed ... it is a cycle! */
+        const uint64_t cycles = (decoder->branches > 2u) ?
+            ((decoder->branches - 2u) / loop->length) : 0u;
+
+        if ( (cycles) &&
+             ( (decoder->loop_repeated) ||
+               ( (!is_each_pc_observed(decoder, variant)) && (!decoder->advance_decoded_run) ) ) )
+        {
+            decoder->branches -= cycles * loop->length;
+
+#if defined(TE_WITH_STATISTICS)
+            decoder->num_loop_skips++;      /* update statistics */
+            decoder->num_loop_iterations += cycles;
+            decoder->statistics.num_instructions += cycles * loop->retired;
+            decoder->statistics.num_branches += cycles * loop->length;
+            decoder->statistics.num_taken += cycles * loop->taken;
+#endif  /* TE_WITH_STATISTICS */
+
+            if (decoder->loop_repeated)
+            {
+                te_flush_decoded_pcs(decoder);  /* preserve the order */
+                end_decoded_run(decoder, TE_RUN_END_FLUSH);
+                (decoder->loop_repeated)(
+                    decoder->user_data,
+                    decoder->pc,    /* first PC of each cycle */
+                    this_pc,        /* last PC of each cycle */
+                    cycles,
+                    loop->retired);
+            }
+        }
+    }
+    else if (loop->length < loop->power)
+    {
+        return;     /* keep the same anchor, for now */
+    }
+    else if (loop->power < TE_LOOP_MAX_BRANCHES)
+    {
+        loop->power <<= 1;  /* look for a longer cycle */
+    }
+    else
+    {
+        loop->power = 1u;   /* give up, and start again */
+    }
+
+    /* move the anchor here */
+    loop->anchor = this_pc;
+    loop->length = 0;
+    loop->taken = 0;
+    loop->retired = 0;
+    loop->periodic = true;
+}
+
+
+/*
+ * Allocate the decode caches for the current context, to suit decoded_cache_sets,
+ * decoded_cache_ways and cold_cache_open_slots (but do not initialize them).
+ * The basic_block_cache[] and cfg_cache[] are not allocated here, but
+ * only on first use (see get_basic_block() and get_cfg_path()). So, a
+ * context in which no execution path is followed allocates neither, and
+ * the cfg_cache[] is never allocated with the branch predictor, nor when
+ * each PC (or each run of PCs) is observed.
+ */
+static void allocate_decode_caches(
+    te_decoder_state_t * const decoder)
+{
+    assert(decoder);
+
+    decoder->decoded_cache = malloc(
+        decoder->decoded_cache_sets * decoder->decoded_cache_ways * sizeof(te_hot_instruction_t));
+    assert(decoder->decoded_cache);
+    decoder->cold_cache_slots = decoder->cold_cache_open_slots;
+    decoder->cold_cache = malloc(decoder->cold_cache_slots * sizeof(te_decoded_instruction_t));
+    assert(decoder->cold_cache);
+}
+
+
+/*
+ * Invalidate the basic_block_cache[] for the current context.
+ */
+static void invalidate_basic_block_cache(
+    te_decoder_state_t * const decoder)
+{
+    assert(decoder);
+    assert(decoder->basic_block_cache);
+
+    memset(decoder->basic_block_cache, 0, TE_BASIC_BLOCK_CACHE_SIZE * sizeof(te_basic_block_t));
 }
 
 
 /*
- * Determine if instruction is an inferrable jump
+ * Invalidate the cfg_cache[] for the current context.
  */
-static bool is_inferrable_jump(
-    const te_decoded_instruction_t * const instr)
+static void invalidate_cfg_cache(
+    te_decoder_state_t * const decoder)
 {
-    bool predicate = false;
-
-    assert(instr);
+    assert(decoder);
+    assert(decoder->cfg_cache);
 
-    if ( (instr->decode.op == rv_op_jal)    ||
-         (instr->decode.op == rv_op_c_jal)  ||
-         (instr->decode.op == rv_op_c_j)    ||
-         ( (instr->decode.op == rv_op_jalr) &&
-           (0 == instr->decode.rs1) ) )
+    for (size_t i = 0; i < TE_CFG_CACHE_SIZE; i++)
     {
-        predicate = true;
+        decoder->cfg_cache[i].start = TE_SENTINEL_BAD_ADDRESS;
     }
-
-    return predicate;
 }
 
 
 /*
- * Determine if instruction is an uninferrable jump
+ * Invalidate all the decode caches for the current context, so that
+ * no slot matches any valid address. Any predecoded ranges are
+ * retained, as they apply to all contexts (see te_predecode_image()).
  */
-static bool is_uninferrable_jump(
-    const te_decoded_instruction_t * const instr)
+static void invalidate_decode_caches(
+    te_decoder_state_t * const decoder)
 {
-    bool predicate = false;
-
-    assert(instr);
+    assert(decoder);
 
-    if ( ( (instr->decode.op == rv_op_jalr) &&
-           (0 != instr->decode.rs1) )       ||
-         (instr->decode.op == rv_op_c_jalr) ||
-         (instr->decode.op == rv_op_c_jr) )
+    for (size_t i = 0; i < decoder->decoded_cache_sets * decoder->decoded_cache_ways; i++)
     {
-        predicate = true;
+        decoder->decoded_cache[i].pc = TE_SENTINEL_BAD_ADDRESS;
+    }
+    for (size_t i = 0; i < decoder->cold_cache_slots; i++)
+    {
+        decoder->cold_cache[i].decode.pc = TE_SENTINEL_BAD_ADDRESS;
+    }
+    if (decoder->basic_block_cache)     /* allocated yet ? */
+    {
+        invalidate_basic_block_cache(decoder);
+    }
+    if (decoder->cfg_cache)             /* allocated yet ? */
+    {
+        invalidate_cfg_cache(decoder);
     }
-
-    return predicate;
 }
 
 
+#if TE_CONTEXT_CACHES
 /*
- * Determine if instruction is an uninferrable discontinuity
+ * Exchange the decode caches for the current context,
+ * with the set of decode caches in "caches".
  */
-static bool is_uninferrable_discon(
-    const te_decoded_instruction_t * const instr)
+static void swap_decode_caches(
+    te_decoder_state_t * const decoder,
+    struct te_context_caches_t * const caches)
 {
-    bool predicate = false;
+#define TE_SWAP_FIELD(type, field)          \
+do                                          \
+{                                           \
+    type const temp = decoder->field;       \
+    decoder->field = caches->field;         \
+    caches->field = temp;                   \
+} while (0)
 
-    assert(instr);
+    assert(decoder);
+    assert(caches);
 
-    /*
-     * Note: The exception reporting mechanism means it is not necessary
-     * to include ECALL, EBREAK or C.EBREAK in this predicate
-     */
-    if ( is_uninferrable_jump(instr)        ||
-         (instr->decode.op == rv_op_uret)   ||
-         (instr->decode.op == rv_op_sret)   ||
-         (instr->decode.op == rv_op_mret)   ||
-         (instr->decode.op == rv_op_dret) )
-    {
-        predicate = true;
-    }
+    TE_SWAP_FIELD(te_hot_instruction_t *, decoded_cache);
+    TE_SWAP_FIELD(te_decoded_instruction_t *, cold_cache);
+    TE_SWAP_FIELD(size_t, cold_cache_slots);
+    TE_SWAP_FIELD(te_basic_block_t *, basic_block_cache);
+    TE_SWAP_FIELD(te_cfg_node_t *, cfg_cache);
 
-    return predicate;
+#undef TE_SWAP_FIELD
 }
+#endif  /* TE_CONTEXT_CACHES */
 
 
 /*
- * Determine if instruction is a sequentially inferrable jump
+ * Change the current context to "context", setting aside the decode
+ * caches for the previous context, and re-instating those for the new
+ * context, if they were set aside earlier. Otherwise, the least recently
+ * used set of decode caches is invalidated, and used for the new context.
+ * See the comment for TE_CONTEXT_CACHES.
  */
-static bool is_sequential_jump(
+static void change_context(
     te_decoder_state_t * const decoder,
-    const te_decoded_instruction_t * const instr,
-    const te_address_t prev_addr)
+    const uint32_t context)
 {
-    te_decoded_instruction_t prev_instr = { .decode.pc = TE_SENTINEL_BAD_ADDRESS };
-    bool predicate = false;
-
     assert(decoder);
-    assert(instr);
 
-    if (!is_uninferrable_jump(instr))
+    if (context == decoder->context)
     {
-        return false;
+        return;     /* no change */
     }
 
-    (void)get_instr(decoder, prev_addr, &prev_instr);
+    /* pass on everything referring to the previous context's caches */
+    end_decoded_run(decoder, TE_RUN_END_OTHER);
+    te_flush_decoded_pcs(decoder);
+
+    decoder->context_changes++;
 
-    if ( (prev_instr.decode.op == rv_op_auipc) ||
-         (prev_instr.decode.op == rv_op_lui)   ||
-         (prev_instr.decode.op == rv_op_c_lui) )
+#if TE_CONTEXT_CACHES
+    if (!decoder->context_caches)
     {
-        predicate = (instr->decode.rs1 == prev_instr.decode.rd);
+        decoder->context_caches = calloc(TE_CONTEXT_CACHES, sizeof(struct te_context_caches_t));
+        assert(decoder->context_caches);
     }
 
-    return predicate;
-}
-
-
-/*
- * Find the target of a sequentially inferrable jump
- */
-static te_address_t sequential_jump_target(
-    te_decoder_state_t * const decoder,
-    const te_address_t addr,
-    const te_address_t prev_addr)
-{
-    te_decoded_instruction_t instr      = { .decode.pc = TE_SENTINEL_BAD_ADDRESS };
-    te_decoded_instruction_t prev_instr = { .decode.pc = TE_SENTINEL_BAD_ADDRESS };
-    te_address_t target = 0;
-
-    assert(decoder);
-
-    (void)get_instr(decoder, addr, &instr);
-    (void)get_instr(decoder, prev_addr, &prev_instr);
-
-    if (prev_instr.decode.op == rv_op_auipc)
+    /*
+     * find the caches set aside for "context", if any, otherwise
+     * those least recently used (preferring those never used).
+     */
+    struct te_context_caches_t * caches = &decoder->context_caches[0];
+    bool found = false;
+    for (size_t i = 0; i < TE_CONTEXT_CACHES; i++)
     {
-        target = prev_addr;
+        struct te_context_caches_t * const candidate = &decoder->context_caches[i];
+        if ( (candidate->last_used) && (candidate->context == context) )
+        {
+            caches = candidate;
+            found = true;
+            break;
+        }
+        if (candidate->last_used < caches->last_used)
+        {
+            caches = candidate;
+        }
     }
 
-    const int64_t imm = prev_instr.decode.imm;
-    target += (te_address_t)imm;
+    /* set aside the current caches, and use those found */
+    swap_decode_caches(decoder, caches);
+    caches->context = decoder->context;
+    caches->last_used = decoder->context_changes;
 
-    if (instr.decode.op == rv_op_jalr)
+    if (!found)
     {
-        const int64_t imm2 = instr.decode.imm;
-        target += (te_address_t)imm2;
+        if (!decoder->decoded_cache)    /* never used ? */
+        {
+            allocate_decode_caches(decoder);
+        }
+        invalidate_decode_caches(decoder);
+#if defined(TE_WITH_STATISTICS)
+        decoder->num_context_misses++;
+#endif  /* TE_WITH_STATISTICS */
     }
+#else   /* TE_CONTEXT_CACHES */
+    invalidate_decode_caches(decoder);
+#if defined(TE_WITH_STATISTICS)
+    decoder->num_context_misses++;
+#endif  /* TE_WITH_STATISTICS */
+#endif  /* TE_CONTEXT_CACHES */
 
-    return target;
+    decoder->context = context;
 }
 
 
 /*
- * Determine if instruction is a call
- * - excludes tail calls as they do not push an address onto the return stack
+ * Called on reaching the reported address of a te_inst start packet
+ * (which is not the first), once all the preceding instructions, which
+ * retired in the previous context, have been followed. Change to the
+ * context of the instruction at "address", and only then decode it, to
+ * count it as 1 unprocessed branch, if it is a branch.
  */
-static bool is_call(
-    const te_decoded_instruction_t * const instr)
+static void enter_start_address(
+    te_decoder_state_t * const decoder,
+    const te_inst_t * const te_inst)
 {
-    bool predicate = false;
+    assert(decoder);
+    assert(te_inst);
+    assert(decoder->context_pending);
 
-    assert(instr);
+    decoder->context_pending = false;
+    change_context(decoder, te_inst->context);
 
-    if ( ( (instr->decode.op == rv_op_jalr) &&
-           (1 == instr->decode.rd) )        ||
-         (instr->decode.op == rv_op_c_jalr) ||
-         ( (instr->decode.op == rv_op_jal)  &&
-           (1 == instr->decode.rd) )        ||
-         (instr->decode.op == rv_op_c_jal) )
+    if ( (decoder->count_start_branch) &&
+         (is_branch(get_instr(decoder, decoder->pc))) )
     {
-        predicate = true;
+        const uint32_t branch = te_inst->branch ? 1 : 0;
+        decoder->branch_map |= (branch << decoder->branches);
+        decoder->branches++;
     }
-
-    return predicate;
 }
 
 
 /*
- * Determine if instruction return address can be implicitly inferred
+ * Compute the next PC
+ *
+ * Returns true if it is an uninferrable discontinuity,
+ * and a return address was NOT popped from the irstack.
+ * i.e. the parameter "address" is assigned to the PC.
+ * Otherwise this function returns false.
+ *
+ * If an unrecoverable error occurs, this function will immeditely
+ * return false, if the function unrecoverable_error() returns.
  */
-static bool is_implicit_return(
-    const te_decoder_state_t * const decoder,
-    const te_decoded_instruction_t * const instr,
-    const te_inst_t * const te_inst)
+static TE_ALWAYS_INLINE bool next_pc(
+    te_decoder_state_t * const decoder,
+    const te_address_t address,
+    const te_inst_t * const te_inst,
+    const unsigned variant)
 {
-    bool predicate = false;
+    bool stop_here = false;
+
     assert(decoder);
-    assert(instr);
     assert(te_inst);
 
-    if (decoder->options.implicit_return == 0)
+    const te_address_t this_pc = decoder->pc;
+    const te_hot_instruction_t * instr = get_instr(decoder, this_pc);
+    const bool branch = is_branch(instr);
+    bool taken = false;
+
+#if defined(TE_WITH_STATISTICS)
+    if (branch)
     {
-        return false;   /* Implicit return mode is disabled */
+        /* update counter with number of branch instructions */
+        decoder->statistics.num_branches++;
     }
+#endif  /* TE_WITH_STATISTICS */
 
     /*
-     * In the following code the value of "te_inst->irfail" is
-     * not the value of the irfail bit physically transmitted
-     * in the te_inst packet. Instead it is a logical XOR
-     * that indicates if the irfail bit physically transmitted
-     * was different from the previously transmitted bit.
-     * See comment in the definition of "te_inst_t" for details.
+     * Both is_sequential_jump() and sequential_jump_target() may look up
+     * the previous instruction, which may evict "instr" from the decoded
+     * cache. So, take a copy of what is needed later, and re-validate it.
      */
-    if ( ( (instr->decode.op == rv_op_jalr) &&
-           (1 == instr->decode.rs1)         &&
-           (0 == instr->decode.rd) )        ||
-         ( (instr->decode.op == rv_op_c_jr) &&
-           (1 == instr->decode.rs1) ) )
+    const bool call = is_call(instr);
+    const bool sequential_jump = is_sequential_jump(decoder, instr, decoder->last_pc);
+    if (instr->pc != this_pc)
     {
-        if ( (te_inst->irfail) &&
-             (te_inst->irdepth == decoder->irstack_depth) )
+        instr = get_instr(decoder, this_pc);
+    }
+
+    if (is_inferrable_jump(instr))
+    {
+        const int64_t imm = instr->imm;
+        decoder->pc += (te_address_t)imm;
+    }
+    else if (sequential_jump)
+    {
+        /* lui/auipc followed by jump using same register */
+        decoder->pc = sequential_jump_target(decoder, decoder->pc, decoder->last_pc);
+    }
+    else if (is_implicit_return(decoder, instr, te_inst, variant))
+    {
+        decoder->pc = pop_return_stack(decoder, variant);
+        decoder->loop.periodic = false;
+    }
+    else if (is_uninferrable_discon(instr))
+    {
+        decoder->loop.periodic = false;
+        if (decoder->stop_at_last_branch)
         {
-            /* implicit return address prediction failed here */
-            predicate = false;
+            unrecoverable_error(decoder, TE_ERROR_UNINFERRABLE, instr);
+            return false;    /* return immediately if an unrecoverable error */
         }
         else
         {
-            /* return true if the irstack is not empty */
-            predicate = (decoder->irstack_depth > 0);
+          decoder->pc = address;
+          stop_here = true;
+        }
+        /* update counter with number of unpredicted discontinuities */
+#if defined(TE_WITH_STATISTICS)
+        decoder->statistics.num_updiscons++;
+#endif  /* TE_WITH_STATISTICS */
+    }
+    else if (is_taken_branch(decoder, instr, variant))
+    {
+        const int64_t imm = instr->imm;
+        decoder->pc += (te_address_t)imm;
+        taken = true;
+        /* update counter with number of taken branches */
+#if defined(TE_WITH_STATISTICS)
+        decoder->statistics.num_taken++;
+#endif  /* TE_WITH_STATISTICS */
+    }
+    else
+    {
+        /*
+         * Note: is_taken_branch() can call unrecoverable_error(),
+         * returning false if unrecoverable_error() returns.
+         */
+        if (TE_ERROR_OKAY != decoder->error_code)
+        {
+            return false; /* return immediately if an unrecoverable error */
         }
+        decoder->pc += instruction_size(instr);
     }
 
-    return predicate;
+    if (call)
+    {
+        push_return_stack(decoder, this_pc, variant);
+        decoder->loop.periodic = false;
+        /* update counter with number of function calls */
+#if defined(TE_WITH_STATISTICS)
+        decoder->statistics.num_calls++;
+#endif  /* TE_WITH_STATISTICS */
+    }
+
+    decoder->last_pc = this_pc;
+    if ( (TE_INST_FORMAT_3_SYNC == te_inst->format) &&
+         (decoder->context_pending)                 &&
+         (decoder->pc == address)                   &&
+         (0 == decoder->branches) )
+    {
+        /* the instruction at "address" retires in the new context */
+        enter_start_address(decoder, te_inst);
+    }
+    disseminate_pc(decoder, variant);
+
+    decoder->loop.retired++;
+    if (branch)
+    {
+        accelerate_loop(decoder, this_pc, taken, variant);
+    }
+
+    return stop_here;
 }
 
 
 /*
- * Push address onto the implicit return stack
+ * Return the basic block which starts at "address", from the basic
+ * block cache. If it is not already in the cache, then it is built
+ * (by decoding each instruction in the block in turn), and cached.
+ * The returned pointer is only valid until the next call.
+ *
+ * So that no instruction is fetched which might not be executed, the
+ * block also ends at any instruction which may trap, and at "stop"
+ * (the address at which the caller will stop following the execution
+ * path, or TE_SENTINEL_BAD_ADDRESS if there is none).
  */
-static void push_return_stack(
+static const te_basic_block_t * get_basic_block(
     te_decoder_state_t * const decoder,
-    const te_address_t address)
+    const te_address_t address,
+    const te_address_t stop)
 {
-    te_decoded_instruction_t instr = { .decode.pc = TE_SENTINEL_BAD_ADDRESS };
-    te_address_t link_reg = address;
-    size_t i;
+    const te_hot_instruction_t * instr = NULL;
+    te_address_t pc = address;
 
     assert(decoder);
+    assert(TE_SENTINEL_BAD_ADDRESS != address);
 
-    if (!decoder->options.implicit_return)
+    /* allocate the basic_block_cache[] on first use */
+    if (!decoder->basic_block_cache)
     {
-        return;     /* Implicit return mode is disabled */
+        decoder->basic_block_cache = malloc(TE_BASIC_BLOCK_CACHE_SIZE * sizeof(te_basic_block_t));
+        assert(decoder->basic_block_cache);
+        invalidate_basic_block_cache(decoder);
     }
 
-    const size_t irstack_depth_max =
-        (decoder->discovery_response.return_stack_size) ?
-            (size_t)1 << decoder->discovery_response.return_stack_size :
-            (size_t)1 << decoder->discovery_response.call_counter_size;
-    assert(decoder->irstack_depth <= irstack_depth_max);
-    assert(irstack_depth_max <= TE_MAX_IRSTACK_DEPTH);
+    te_basic_block_t * const block =
+        &decoder->basic_block_cache[TE_BLOCK_SLOT_NUMBER(address)];
 
-    if (irstack_depth_max == decoder->irstack_depth)
+#if defined(TE_WITH_STATISTICS)
+    decoder->num_block_gets++;      /* update statistics */
+#endif  /* TE_WITH_STATISTICS */
+
+    /*
+     * is "address" currently in our basic block cache ?
+     * (a block which ended at a different "stop" is built again)
+     */
+    if ( (block->count) && (block->start == address) &&
+         ( (TE_BLOCK_END_STOP != block->end) || (block->last == stop) ) )
     {
-        /* Delete oldest entry from irstack to make room for new entry added below */
-        decoder->irstack_depth--;
-        for (i = 0; i < decoder->irstack_depth; i++)
-        {
-            decoder->return_stack[i] = decoder->return_stack[i+1];
-        }
+#if defined(TE_WITH_STATISTICS)
+        decoder->num_block_hits++;  /* update statistics */
+#endif  /* TE_WITH_STATISTICS */
+        return block;
     }
 
-    /* link register is address of next spatial instruction */
-    (void)get_instr(decoder, address, &instr);
-    link_reg += instruction_size(&instr);
+    /* otherwise, build a new block, and replace the one in the slot */
+    memset(block, 0, sizeof(*block));
+    block->start = address;
+    block->penultimate = TE_SENTINEL_BAD_ADDRESS;
+    block->taken = TE_SENTINEL_BAD_ADDRESS;
 
-    /* optionally show what we will push onto the irstack */
-    if ((decoder->debug_stream) && (decoder->debug_flags & TE_DEBUG_IMPLICIT_RETURN))
+    while (true)
     {
-        fprintf(decoder->debug_stream,
-            "irstack: pushed [%3" PRIu64 "] <-- %08" PRIx64 "\n",
-            decoder->irstack_depth,
-            link_reg);
+        instr = get_instr(decoder, pc);
+
+        if (4 == instruction_size(instr))
+        {
+            block->wide |= (uint64_t)1 << block->count;
+        }
+        if (block->count)
+        {
+            block->penultimate = block->last;
+        }
+        block->last = pc;
+        block->count++;
+        block->length += instruction_size(instr);
+        pc += instruction_size(instr);
+
+        /* the classification here must mirror that in next_pc() */
+        if (is_branch(instr))
+        {
+            block->end = TE_BLOCK_END_BRANCH;
+            block->taken = block->last + (te_address_t)(int64_t)instr->imm;
+            break;
+        }
+        else if (is_inferrable_jump(instr))
+        {
+            block->end = TE_BLOCK_END_INFERRABLE_JUMP;
+            block->taken = block->last + (te_address_t)(int64_t)instr->imm;
+            break;
+        }
+        else if (is_uninferrable_discon(instr))
+        {
+            block->end = TE_BLOCK_END_UNINFERRABLE;
+            break;
+        }
+        else if (is_trap_instruction(instr))
+        {
+            block->end = TE_BLOCK_END_TRAP;
+            break;
+        }
+        else if (block->last == stop)
+        {
+            block->end = TE_BLOCK_END_STOP;
+            break;
+        }
+        else if (TE_MAX_BLOCK_INSTRUCTIONS == block->count)
+        {
+            block->end = TE_BLOCK_END_LIMIT;
+            break;
+        }
     }
 
-    /* push link register to top of the irstack */
-    decoder->return_stack[decoder->irstack_depth] = link_reg;
-    decoder->irstack_depth++;
+    block->not_taken = pc;
+
+    return block;
 }
 
 
 /*
- * Pop address from the implicit return stack
+ * Advance the PC over the run of sequential instructions that starts
+ * at the current PC, stopping on the instruction which terminates
+ * its basic block. This is equivalent to calling next_pc() for
+ * each instruction in the run, but is considerably cheaper.
+ *
+ * Returns true if the PC was advanced. Otherwise, returns false
+ * and nothing is changed, if the current PC is not sequential, or
+ * if "address" lies within the run (as the caller will then need
+ * to check for it after each and every instruction), or if the run
+ * ends at "address" where the context is to change (see next_pc()).
  */
-static te_address_t pop_return_stack(
-    te_decoder_state_t * const decoder)
+static TE_ALWAYS_INLINE bool advance_basic_block(
+    te_decoder_state_t * const decoder,
+    const te_address_t address,
+    const unsigned variant)
 {
     assert(decoder);
 
-    /*
-     * Note: this function is not called if irstack_depth is 0,
-     * so no need to check for underflow
-     */
-    decoder->irstack_depth--;
+    const te_basic_block_t * const block = get_basic_block(decoder, decoder->pc, address);
+
+    if ( (block->count < 2) ||
+         ( (address > block->start) && (address < block->last) ) )
+    {
+        return false;   /* must proceed one instruction at a time */
+    }
+    if ( (decoder->context_pending) &&
+         (address == block->last)   &&
+         (0 == decoder->branches) )
+    {
+        return false;   /* next_pc() must change the context at "address" */
+    }
 
-    const te_address_t link_reg = decoder->return_stack[decoder->irstack_depth];
+#if defined(TE_WITH_STATISTICS)
+    decoder->num_block_steps++;     /* update statistics */
+#endif  /* TE_WITH_STATISTICS */
 
-    /* optionally show what we will pop from the irstack */
-    if ((decoder->debug_stream) && (decoder->debug_flags & TE_DEBUG_IMPLICIT_RETURN))
+    if (is_each_pc_observed(decoder, variant))
     {
-        fprintf(decoder->debug_stream,
-            "irstack: popped [%3" PRIu64 "] --> %08" PRIx64 "\n",
-            decoder->irstack_depth,
-            link_reg);
+        /* somebody wants to see every PC, so disseminate each one in turn */
+        te_address_t pc = block->start;
+        for (unsigned i = 0; i + 1u < block->count; i++)
+        {
+            decoder->last_pc = pc;
+            pc += ((block->wide >> i) & 1u) ? 4u : 2u;
+            decoder->pc = pc;
+            disseminate_pc(decoder, variant);
+        }
+    }
+    else
+    {
+        /* nobody is watching, so just jump to the end of the run */
+        decoder->last_pc = block->penultimate;
+        decoder->pc = block->last;
+        if (decoder->advance_decoded_run)
+        {
+            /* ... but still append all of it to the current run */
+            append_decoded_run(decoder,
+                block->start + (((block->wide & 1u)) ? 4u : 2u),
+                block->last,
+                block->count - 1u,
+                block->not_taken,
+                get_classes(get_instr(decoder, block->last)));
+        }
+#if defined(TE_WITH_STATISTICS)
+        decoder->statistics.num_instructions += block->count - 1u;
+#endif  /* TE_WITH_STATISTICS */
     }
 
-    return link_reg;
+    assert(decoder->pc == block->last);
+    decoder->loop.retired += block->count - 1u;
+
+    return true;
 }
 
 
 /*
- * Compute the next PC
- *
- * Returns true if it is an uninferrable discontinuity,
- * and a return address was NOT popped from the irstack.
- * i.e. the parameter "address" is assigned to the PC.
- * Otherwise this function returns false.
- *
- * If an unrecoverable error occurs, this function will immeditely
- * return false, if the function unrecoverable_error() returns.
+ * Return the path followed from the CFG node at "address", for the
+ * TE_CFG_CHUNK_BITS bits of the branch_map given in "bits", from the
+ * CFG node cache. If it is not already in the cache, then it is built
+ * (by following each basic block in turn), and cached.
+ * The returned pointer is only valid until the next call.
  */
-static bool next_pc(
+static const te_cfg_path_t * get_cfg_path(
     te_decoder_state_t * const decoder,
     const te_address_t address,
-    const te_inst_t * const te_inst)
+    const unsigned bits)
 {
-    bool stop_here = false;
+    te_address_t pc = address;
+    te_address_t last_pc = TE_SENTINEL_BAD_ADDRESS;
+    uint32_t instructions = 0;
+    unsigned taken = 0;
 
     assert(decoder);
-    assert(te_inst);
-
-    const te_address_t this_pc = decoder->pc;
-    te_decoded_instruction_t instr = { .decode.pc = TE_SENTINEL_BAD_ADDRESS };
-
-    (void)get_instr(decoder, decoder->pc, &instr);
+    assert(bits < TE_CFG_CHUNK_SIZE);
 
-#if defined(TE_WITH_STATISTICS)
-    if (is_branch(&instr))
+    /* allocate the cfg_cache[] on first use */
+    if (!decoder->cfg_cache)
     {
-        /* update counter with number of branch instructions */
-        decoder->statistics.num_branches++;
+        decoder->cfg_cache = malloc(TE_CFG_CACHE_SIZE * sizeof(te_cfg_node_t));
+        assert(decoder->cfg_cache);
+        invalidate_cfg_cache(decoder);
     }
-#endif  /* TE_WITH_STATISTICS */
 
-    if (is_inferrable_jump(&instr))
-    {
-        const int64_t imm = instr.decode.imm;
-        decoder->pc += (te_address_t)imm;
-    }
-    else if (is_sequential_jump(decoder, &instr, decoder->last_pc))
+    te_cfg_node_t * const node = &decoder->cfg_cache[TE_CFG_SLOT_NUMBER(address)];
+    te_cfg_path_t * const path = &node->paths[bits];
+
+    /* replace the node in the slot, if it is not for "address" */
+    if (node->start != address)
     {
-        /* lui/auipc followed by jump using same register */
-        decoder->pc = sequential_jump_target(decoder, decoder->pc, decoder->last_pc);
+        memset(node, 0, sizeof(*node));
+        node->start = address;
     }
-    else if (is_implicit_return(decoder, &instr, te_inst))
+
+    if (path->valid)
     {
-        decoder->pc = pop_return_stack(decoder);
+        return path;
     }
-    else if (is_uninferrable_discon(&instr))
+
+    /* otherwise, build it, assuming it will not be usable */
+    path->valid = true;
+    path->usable = false;
+
+    for (unsigned i = 0; i < TE_CFG_CHUNK_BITS; i++)
     {
-        if (decoder->stop_at_last_branch)
+        const te_basic_block_t * const block =
+            get_basic_block(decoder, pc, TE_SENTINEL_BAD_ADDRESS);
+
+        if (TE_BLOCK_END_BRANCH != block->end)
         {
-            unrecoverable_error(decoder, TE_ERROR_UNINFERRABLE, &instr);
-            return false;    /* return immediately if an unrecoverable error */
+            return path;    /* not a CFG node, so not usable */
+        }
+
+        instructions += block->count;
+        last_pc = block->last;
+
+        /* branch_map bits are 1 for not taken, and 0 for taken */
+        if ((bits >> i) & 1u)
+        {
+            pc = block->not_taken;
         }
         else
         {
-          decoder->pc = address;
-          stop_here = true;
+            pc = block->taken;
+            taken++;
         }
-        /* update counter with number of unpredicted discontinuities */
-#if defined(TE_WITH_STATISTICS)
-        decoder->statistics.num_updiscons++;
-#endif  /* TE_WITH_STATISTICS */
     }
-    else if (is_taken_branch(decoder, &instr))
+
+    path->pc = pc;
+    path->last_pc = last_pc;
+    path->instructions = instructions;
+    path->taken = (uint8_t)taken;
+    path->usable = true;
+
+    return path;
+}
+
+
+/*
+ * Advance the PC over the next TE_CFG_CHUNK_BITS branches, consuming
+ * that many bits from the branch_map, in a single step, using the CFG.
+ * This is equivalent to calling next_pc() for each instruction on the
+ * path, but is considerably cheaper.
+ *
+ * Returns true if the PC was advanced. Otherwise, returns false
+ * and nothing is changed.
+ *
+ * Note: all the checks for stopping in follow_execution_path() require
+ * that at most one branch remains to be processed (or an uninferrable
+ * discontinuity, which a CFG node never contains). So, providing more
+ * than TE_CFG_CHUNK_BITS branches remain, none of the checks can be
+ * satisfied before the end of the path, irrespective of "address".
+ */
+static TE_ALWAYS_INLINE bool advance_branches(
+    te_decoder_state_t * const decoder,
+    const unsigned variant)
+{
+    assert(decoder);
+
+    if ( (decoder->branches <= TE_CFG_CHUNK_BITS)       ||
+         (variant & TE_VARIANT_BRANCH_PREDICTION)           ||
+         (decoder->bpred.correct_predictions)           ||
+         (decoder->bpred.use_bmap_first)                ||
+         (decoder->bpred.miss_predict_carry_in)         ||
+         (decoder->advance_decoded_run)                 ||
+         (is_each_pc_observed(decoder, variant)) )
     {
-        const int64_t imm = instr.decode.imm;
-        decoder->pc += (te_address_t)imm;
-        /* update counter with number of taken branches */
-#if defined(TE_WITH_STATISTICS)
-        decoder->statistics.num_taken++;
-#endif  /* TE_WITH_STATISTICS */
+        return false;   /* must proceed one branch at a time */
     }
-    else
+
+    const unsigned bits = decoder->branch_map & (TE_CFG_CHUNK_SIZE - 1u);
+    const te_cfg_path_t * const path = get_cfg_path(decoder, decoder->pc, bits);
+
+    if (!path->usable)
     {
-        /*
-         * Note: is_taken_branch() can call unrecoverable_error(),
-         * returning false if unrecoverable_error() returns.
-         */
-        if (TE_ERROR_OKAY != decoder->error_code)
-        {
-            return false; /* return immediately if an unrecoverable error */
-        }
-        decoder->pc += instruction_size(&instr);
+        return false;   /* must proceed one branch at a time */
     }
 
-    if (is_call(&instr))
-    {
-        push_return_stack(decoder, this_pc);
-        /* update counter with number of function calls */
+    decoder->branches -= TE_CFG_CHUNK_BITS;
+    decoder->branch_map >>= TE_CFG_CHUNK_BITS;
+    decoder->last_pc = path->last_pc;
+    decoder->pc = path->pc;
+    decoder->loop.retired += path->instructions;
+
 #if defined(TE_WITH_STATISTICS)
-        decoder->statistics.num_calls++;
+    decoder->num_cfg_steps++;       /* update statistics */
+    decoder->statistics.num_instructions += path->instructions;
+    decoder->statistics.num_branches += TE_CFG_CHUNK_BITS;
+    decoder->statistics.num_taken += path->taken;
 #endif  /* TE_WITH_STATISTICS */
-    }
 
-    decoder->last_pc = this_pc;
-    disseminate_pc(decoder);
-
-    return stop_here;
+    return true;
 }
 
 
@@ -876,33 +2428,37 @@ static bool next_pc(
  * If an unrecoverable error occurs, this function will immeditely
  * return, if the function unrecoverable_error() returns.
  */
-static void follow_execution_path(
+static TE_ALWAYS_INLINE void follow_execution_path_variant(
     te_decoder_state_t * const decoder,
     const te_address_t address,
-    const te_inst_t * const te_inst)
+    const te_inst_t * const te_inst,
+    const unsigned variant)
 {
     assert(decoder);
 
     te_address_t previous_address = decoder->pc;
-    te_decoded_instruction_t instr = { .decode.pc = TE_SENTINEL_BAD_ADDRESS };
 
     assert(te_inst);
 
-    (void)get_instr(decoder, decoder->pc, &instr);
-
-    if ((decoder->debug_stream) && (decoder->debug_flags & TE_DEBUG_FOLLOW_PATH))
+    if ((variant & TE_VARIANT_DEBUG) && (decoder->debug_stream) && (decoder->debug_flags & TE_DEBUG_FOLLOW_PATH))
     {
         fprintf(decoder->debug_stream,
             "entered %s() with format = %u, pc = 0x%" PRIx64 ", and address = 0x%" PRIx64 "\n",
             __func__, te_inst->format, decoder->pc, address);
     }
 
+    /* do not detect cycles across packets */
+    decoder->loop.anchor = TE_SENTINEL_BAD_ADDRESS;
+    decoder->loop.power = 1u;
+    decoder->loop.length = 0;
+    decoder->loop.periodic = false;
+
     while (true)
     {
         if ( (decoder->stop_at_last_branch) &&
              (0 == decoder->branches) )
         {
-            unrecoverable_error(decoder, TE_ERROR_BAD_FOLLOW, &instr);
+            unrecoverable_error(decoder, TE_ERROR_BAD_FOLLOW, get_instr(decoder, decoder->pc));
             return; /* return immediately if an unrecoverable error */
         }
 
@@ -910,8 +2466,14 @@ static void follow_execution_path(
         {
             /*
              * iterate again from previously reported address to find second occurrence
+             *
+             * Note: a run of sequential instructions never stops here,
+             * so it can be skipped over in a single step.
              */
-            const bool stop_here = next_pc(decoder, previous_address, te_inst);
+            const bool stop_here =
+                (!advance_branches(decoder, variant)) &&
+                (!advance_basic_block(decoder, previous_address, variant)) &&
+                (next_pc(decoder, previous_address, te_inst, variant));
             /*
              * Note: next_pc() can call unrecoverable_error(),
              * returning false if unrecoverable_error() returns.
@@ -920,7 +2482,6 @@ static void follow_execution_path(
             {
                 return; /* return immediately if an unrecoverable error */
             }
-            (void)get_instr(decoder, decoder->pc, &instr);
             if (stop_here)
             {
                 decoder->inferred_address = false;
@@ -928,7 +2489,16 @@ static void follow_execution_path(
         }
         else
         {
-            const bool stop_here = next_pc(decoder, address, te_inst);
+            /*
+             * None of the following checks can be satisfied part way
+             * through a run of sequential instructions (unless "address"
+             * lies within the run), so it can be skipped in a single step.
+             * Likewise, whilst many branches remain to be processed.
+             */
+            const bool stop_here =
+                (!advance_branches(decoder, variant)) &&
+                (!advance_basic_block(decoder, address, variant)) &&
+                (next_pc(decoder, address, te_inst, variant));
             /*
              * Note: next_pc() can call unrecoverable_error(),
              * returning false if unrecoverable_error() returns.
@@ -937,9 +2507,9 @@ static void follow_execution_path(
             {
                 return; /* return immediately if an unrecoverable error */
             }
-            (void)get_instr(decoder, decoder->pc, &instr);
-            if ( (1 == decoder->branches)                             &&
-                 (is_branch(get_instr(decoder, decoder->pc, &instr))) &&
+            const te_hot_instruction_t * const instr = get_instr(decoder, decoder->pc);
+            if ( (1 == decoder->branches)       &&
+                 (is_branch(instr))             &&
                  (decoder->stop_at_last_branch) )
             {
                 /*
@@ -954,12 +2524,14 @@ static void follow_execution_path(
                 /*
                  * Reached reported address following an uninferrable discontinuity - stop here
                  */
-                if (decoder->branches > (is_branch(get_instr(decoder, decoder->pc, &instr)) ? 1 : 0))
+                if ( (decoder->context_pending) ||
+                     (decoder->branches > (is_branch(instr) ? 1 : 0)) )
                 {
                     /*
-                     * Check all branches processed (except 1 if this instruction is a branch)
+                     * Check all branches processed (except 1 if this instruction is a branch),
+                     * and so the context was changed here, if it is a start packet
                      */
-                    unrecoverable_error(decoder, TE_ERROR_UNPROCESSED, &instr);
+                    unrecoverable_error(decoder, TE_ERROR_UNPROCESSED, instr);
                     return; /* return immediately if an unrecoverable error */
                 }
                 return;
@@ -976,7 +2548,7 @@ static void follow_execution_path(
                  (decoder->pc == address)                       &&
                  (!decoder->stop_at_last_branch)                &&
                  (te_inst->notify)                              &&
-                 (decoder->branches == (is_branch(get_instr(decoder, decoder->pc, &instr)) ? 1 : 0)) )
+                 (decoder->branches == (is_branch(instr) ? 1 : 0)) )
             {
                 /*
                  * All branches processed, and reached reported address due
@@ -996,7 +2568,7 @@ static void follow_execution_path(
                  (decoder->pc == address)                       &&
                  (!decoder->stop_at_last_branch)                &&
                  (!te_inst->updiscon)                           &&
-                 (decoder->branches == (is_branch(get_instr(decoder, decoder->pc, &instr)) ? 1 : 0)) )
+                 (decoder->branches == (is_branch(instr) ? 1 : 0)) )
             {
                 /*
                  * All branches processed, and reached reported address, but not as an
@@ -1008,7 +2580,8 @@ static void follow_execution_path(
             }
             if ( (TE_INST_FORMAT_3_SYNC == te_inst->format)     &&
                  (decoder->pc == address)                       &&
-                 (decoder->branches == (is_branch(get_instr(decoder, decoder->pc, &instr)) ? 1 : 0)) )
+                 (!decoder->context_pending)                    &&
+                 (decoder->branches == (is_branch(instr) ? 1 : 0)) )
             {
                 /* All branches processed, and reached reported address */
                 return;
@@ -1017,6 +2590,63 @@ static void follow_execution_path(
     }
 }
 
+/*
+ * Instantiate a copy of follow_execution_path_variant() (and all the
+ * functions it calls for each instruction, which are inlined into it)
+ * for each variant, so that the tests of the variant's bits are all
+ * resolved at compile-time, rather than for each and every instruction.
+ */
+#define TE_DEFINE_FOLLOW_EXECUTION_PATH(variant)                    \
+static void follow_execution_path_##variant(                        \
+    te_decoder_state_t * const decoder,                             \
+    const te_address_t address,                                     \
+    const te_inst_t * const te_inst)                                \
+{                                                                   \
+    follow_execution_path_variant(decoder, address, te_inst, variant); \
+}
+
+TE_DEFINE_FOLLOW_EXECUTION_PATH(0)
+TE_DEFINE_FOLLOW_EXECUTION_PATH(1)
+TE_DEFINE_FOLLOW_EXECUTION_PATH(2)
+TE_DEFINE_FOLLOW_EXECUTION_PATH(3)
+TE_DEFINE_FOLLOW_EXECUTION_PATH(4)
+TE_DEFINE_FOLLOW_EXECUTION_PATH(5)
+TE_DEFINE_FOLLOW_EXECUTION_PATH(6)
+TE_DEFINE_FOLLOW_EXECUTION_PATH(7)
+
+static void (* const follow_execution_path_variants[TE_NUM_VARIANTS])(
+    te_decoder_state_t * const decoder,
+    const te_address_t address,
+    const te_inst_t * const te_inst) =
+{
+    follow_execution_path_0,
+    follow_execution_path_1,
+    follow_execution_path_2,
+    follow_execution_path_3,
+    follow_execution_path_4,
+    follow_execution_path_5,
+    follow_execution_path_6,
+    follow_execution_path_7,
+};
+
+
+/*
+ * Follow execution path to reported address, using the copy of
+ * follow_execution_path_variant() specialised for the current variant.
+ *
+ * If an unrecoverable error occurs, this function will immeditely
+ * return, if the function unrecoverable_error() returns.
+ */
+static void follow_execution_path(
+    te_decoder_state_t * const decoder,
+    const te_address_t address,
+    const te_inst_t * const te_inst)
+{
+    assert(decoder);
+
+    (follow_execution_path_variants[get_variant(decoder)])(decoder, address, te_inst);
+}
+
 
 #define PRINT_CHANGES_FLAG(option)                              \
 do                                                              \
@@ -1087,6 +2717,9 @@ static void process_support(
     decoder->options = support->options;
     decoder->encoder_mode = support->encoder_mode;
 
+    /* follow any changes the user has made to the discovery_response */
+    te_apply_discovery_response(decoder);
+
     if (decoder->options.implicit_exception)
     {
         /* TODO: support the implicit exception mode */
@@ -1108,7 +2741,7 @@ static void process_support(
         decoder->inferred_address = false;
         while (true)
         {
-            const bool stop_here = next_pc(decoder, previous_address, te_inst);
+            const bool stop_here = next_pc(decoder, previous_address, te_inst, get_variant(decoder));
             /*
              * Note: next_pc() can call unrecoverable_error(),
              * returning false if unrecoverable_error() returns.
@@ -1127,18 +2760,15 @@ static void process_support(
 
 
 /*
- * Process a single te_inst packet.
- * Called each time a te_inst packet is received.
+ * Process a single te_inst packet, for te_process_te_inst().
  *
  * If an unrecoverable error occurs, this function will immeditely
  * return, if the function unrecoverable_error() returns.
  */
-void te_process_te_inst(
+static void process_te_inst(
     te_decoder_state_t * const decoder,
     const te_inst_t * const te_inst)
 {
-    te_decoded_instruction_t instr = { .decode.pc = TE_SENTINEL_BAD_ADDRESS };
-
     assert(decoder);
     assert(te_inst);
 
@@ -1206,13 +2836,12 @@ void te_process_te_inst(
             return; /* all done ... nothing more to do */
         }
 
-        /* is it a te_inst synchronization context packet ? */
-        if (TE_INST_SUBFORMAT_CONTEXT == te_inst->subformat)
-        {
-            return; /* all done ... nothing more to do */
-        }
-
-        /* is it a te_inst synchronization exception packet ? */
+        /*
+         * is it a te_inst synchronization exception packet ?
+         * Note: this is done before the context changes, as the
+         * instructions at (and following) decoder->pc were retired
+         * (or raised the exception) in the previous context.
+         */
         if (TE_INST_SUBFORMAT_EXCEPTION == te_inst->subformat)
         {
             /* update counter with number of exceptions */
@@ -1226,7 +2855,8 @@ void te_process_te_inst(
                  * get details about the most recent successfully retired
                  * instruction ... that should be at decoder->pc.
                  */
-                (void)te_get_and_disassemble_instr(decoder, decoder->pc, &instr);
+                const te_decoded_instruction_t * instr =
+                    te_get_decoded_instr(decoder, decoder->pc);
 
                 /*
                  * Here "address" is the instruction address that
@@ -1234,10 +2864,10 @@ void te_process_te_inst(
                  * instruction spatially following the most recent
                  * reconstructed successfully retired instruction.
                  */
-                const te_address_t address = decoder->pc + instr.length;
+                const te_address_t address = decoder->pc + instr->length;
 
                 /* get details about the instruction that raised an exception */
-                (void)te_get_and_disassemble_instr(decoder, address, &instr);
+                instr = te_get_decoded_instr(decoder, address);
 
                 /* print out the instruction that raised an exception */
                 fprintf(decoder->debug_stream,
@@ -1246,11 +2876,34 @@ void te_process_te_inst(
                     decoder->statistics.num_exceptions,
                     decoder->statistics.num_instructions,
                     address,
-                    instr.line);
+                    instr->line);
             }
 #endif  /* TE_WITH_STATISTICS */
         }
 
+        /*
+         * All the remaining synchronization packets report the context
+         * of the instruction at "address", so use its decode caches now.
+         * However, for a start packet which is not the first, the path up
+         * to "address" is followed first, as those instructions retired
+         * in the previous context, and the context is changed on reaching
+         * "address", before its instruction is decoded.
+         */
+        const bool follow_path =
+            (TE_INST_SUBFORMAT_START == te_inst->subformat) &&
+            (!decoder->start_of_trace);
+        if (!follow_path)
+        {
+            change_context(decoder, te_inst->context);
+        }
+
+        /* is it a te_inst synchronization context packet ? */
+        if (TE_INST_SUBFORMAT_CONTEXT == te_inst->subformat)
+        {
+            return; /* all done ... nothing more to do */
+        }
+
+
         /* copy any common fields from the te_inst packet */
         decoder->inferred_address = false;
         decoder->last_sent_addr = (te_inst->address << decoder->discovery_response.iaddress_lsb);
@@ -1264,32 +2917,49 @@ void te_process_te_inst(
             decoder->branch_map = 0;
         }
 
+        bool count_branch = true;
         if (decoder->bpred.miss_predict_carry_out)
         {
             /* carry in any miss-predict from the previous packet */
             decoder->bpred.miss_predict_carry_out = false;
             decoder->bpred.miss_predict_carry_in = true;
-        }
-        else if (is_branch(get_instr(decoder, decoder->last_sent_addr, &instr)))
-        {
-            /* 1 unprocessed branch if this instruction is a branch */
-            const uint32_t branch = te_inst->branch ? 1 : 0;
-            decoder->branch_map |= (branch << decoder->branches);
-            decoder->branches++;
+            count_branch = false;
         }
 
-        if ( (TE_INST_SUBFORMAT_START == te_inst->subformat) &&
-             (!decoder->start_of_trace) )
+        if (follow_path)
         {
+            /*
+             * The instruction at "address" is only decoded (and counted
+             * as 1 unprocessed branch, if it is a branch) on reaching it,
+             * after the context has changed. See enter_start_address().
+             */
+            decoder->context_pending = true;
+            decoder->count_start_branch = count_branch;
             follow_execution_path(decoder, decoder->last_sent_addr, te_inst);
             /* Note: follow_execution_path() can call unrecoverable_error() */
             if (TE_ERROR_OKAY != decoder->error_code)
             {
+                decoder->context_pending = false;
                 return; /* return immediately if an unrecoverable error */
             }
+            if (decoder->context_pending)
+            {
+                /* stopped short of "address", so change context now */
+                decoder->context_pending = false;
+                change_context(decoder, te_inst->context);
+            }
         }
         else
         {
+            if ( (count_branch) &&
+                 (is_branch(get_instr(decoder, decoder->last_sent_addr))) )
+            {
+                /* 1 unprocessed branch if this instruction is a branch */
+                const uint32_t branch = te_inst->branch ? 1 : 0;
+                decoder->branch_map |= (branch << decoder->branches);
+                decoder->branches++;
+            }
+
             /*
              * Firstly, update "last_pc" to be the current PC.
              * This is essentially so that the diagnostics emitted from disseminate_pc() looks right!
@@ -1297,7 +2967,7 @@ void te_process_te_inst(
              */
             decoder->last_pc = decoder->pc;
             decoder->pc = decoder->last_sent_addr;
-            disseminate_pc(decoder);
+            disseminate_pc(decoder, get_variant(decoder));
             /*
              * To avoid the (unlikely, but not impossible) possibility that the
              * instructions currently at "last_pc" and "pc" happen to satisfy
@@ -1396,7 +3066,7 @@ void te_process_te_inst(
 #endif  /* TE_WITH_STATISTICS */
             decoder->stop_at_last_branch = false;
             /* use the address in the jump target cache */
-            assert(te_inst->u.jtc.index < elements_of(decoder->jump_target));
+            assert(te_inst->u.jtc.index < decoder->jump_target_entries);
             decoder->last_sent_addr = decoder->jump_target[te_inst->u.jtc.index];
             if ( (decoder->debug_stream) &&
                  (decoder->debug_flags & TE_DEBUG_JUMP_TARGET_CACHE) )
@@ -1471,15 +3141,50 @@ void te_process_te_inst(
 }
 
 
+/*
+ * Process a single te_inst packet.
+ * Called each time a te_inst packet is received.
+ *
+ * The batch for decoder->advance_decoded_pcs is only allocated once
+ * that call-back has been assigned, as most users never assign it.
+ * Any PCs reconstructed from the packet which are still waiting in
+ * the batch are flushed on return.
+ */
+void te_process_te_inst(
+    te_decoder_state_t * const decoder,
+    const te_inst_t * const te_inst)
+{
+    assert(decoder);
+
+    if ( (decoder->advance_decoded_pcs) && (!decoder->pc_batch) )
+    {
+        decoder->pc_batch = malloc(TE_PC_BATCH_SIZE * sizeof(te_decoded_pc_t));
+        assert(decoder->pc_batch);
+    }
+
+    process_te_inst(decoder, te_inst);
+
+    te_flush_decoded_pcs(decoder);
+}
+
+
 /*
  * Initialize a new instance of a trace-decoder (the state for one instance).
  * If "decoder" is NULL on entry, then memory will be dynamically
  * allocated, otherwise it must point to a pre-allocated region large enough.
  * This returns a pointer to the internal "state" of the trace-decoder.
  *
- * If this function allocated memory (decoder==NULL on entry), the memory
- * should be released (by calling free()), when the instance of the
- * trace-decoder is no longer required.
+ * The decoded_cache[] will have 2^TE_DECODED_CACHE_BITS records, in sets
+ * of TE_DECODED_CACHE_WAYS ways, and the cold_cache[] will have
+ * 2^TE_COLD_CACHE_BITS slots, until te_get_decoded_instr() is first
+ * called, when it grows to 2^TE_OBSERVED_COLD_CACHE_BITS slots.
+ * See te_open_trace_decoder_with_cache().
+ *
+ * The decoded_cache[] (and the other large tables) are always dynamically
+ * allocated, even if "decoder" is not NULL, so te_close_trace_decoder()
+ * MUST be called when the instance of the trace-decoder is no longer
+ * required. This also releases the memory for the instance itself, if
+ * it was allocated here (decoder==NULL), so do not call free() on it.
  */
 te_decoder_state_t * te_open_trace_decoder(
     te_decoder_state_t * decoder,
@@ -1489,6 +3194,52 @@ te_decoder_state_t * te_open_trace_decoder(
     void * const user_data,
     const rv_isa isa)
 {
+    decoder = te_open_trace_decoder_with_cache(
+        decoder,
+        get_instruction,
+        do_custom_instruction,
+        advance_decoded_pc,
+        user_data,
+        isa,
+        TE_DECODED_CACHE_BITS,
+        TE_DECODED_CACHE_WAYS,
+        TE_COLD_CACHE_BITS);
+
+    /* grow the cold_cache[], only once a complete decode is needed */
+    decoder->cold_cache_observed_slots = (size_t)1 << TE_OBSERVED_COLD_CACHE_BITS;
+
+    return decoder;
+}
+
+
+/*
+ * As te_open_trace_decoder(), but the decoded_cache[] will have
+ * 2^cache_bits records in total, in sets of "cache_ways" ways,
+ * where "cache_ways" must be 1 (i.e. direct-mapped), 2 or 4.
+ * The cold_cache[] will always have 2^cold_bits slots, which should be
+ * large enough to hold the working set of the trace, if any per-PC
+ * call-back is used (e.g. advance_decoded_pc), or may be small otherwise.
+ */
+te_decoder_state_t * te_open_trace_decoder_with_cache(
+    te_decoder_state_t * decoder,
+    te_get_instruction_t * const get_instruction,
+    te_do_custom_instruction_t * const do_custom_instruction,
+    te_advance_decoded_pc_t * const advance_decoded_pc,
+    void * const user_data,
+    const rv_isa isa,
+    const unsigned cache_bits,
+    const unsigned cache_ways,
+    const unsigned cold_bits)
+{
+    bool allocated = false;
+
+    assert( (1 == cache_ways) ||
+            (2 == cache_ways) ||
+            (4 == cache_ways) );
+    assert( (cache_bits < 8 * sizeof(size_t)) &&
+            (((size_t)1 << cache_bits) >= cache_ways) );
+    assert(cold_bits < 8 * sizeof(size_t));
+
     if (decoder)
     {
         /* use provided memory, but zero it for ONE trace-decoder instance */
@@ -1499,10 +3250,22 @@ te_decoder_state_t * te_open_trace_decoder(
         /* allocate (and zero) memory for ONE trace-decoder instance */
         decoder = calloc(1, sizeof(te_decoder_state_t));
         assert(decoder);
+        allocated = true;
     }
 
-    /* copy all the call-back function pointers provided */
-    assert(get_instruction);
+    decoder->allocated = allocated;
+
+    /* allocate the decode caches */
+    decoder->decoded_cache_ways = cache_ways;
+    decoder->decoded_cache_sets = ((size_t)1 << cache_bits) / cache_ways;
+    decoder->cold_cache_open_slots = (size_t)1 << cold_bits;
+    allocate_decode_caches(decoder);
+
+    /*
+     * copy all the call-back function pointers provided.
+     * Note: get_instruction may only be NULL, if get_context_instruction
+     * is assigned after opening.
+     */
     decoder->get_instruction = get_instruction;
     decoder->do_custom_instruction = do_custom_instruction;
     decoder->advance_decoded_pc = advance_decoded_pc;
@@ -1520,21 +3283,130 @@ te_decoder_state_t * te_open_trace_decoder(
     decoder->last_sent_addr = TE_SENTINEL_BAD_ADDRESS;
     decoder->start_of_trace = true;
 
-    /* initialize the branch predictor lookup table */
-    te_initialize_bpred_table(&decoder->bpred);
+    /* ensure no slot in the decode caches matches any valid address */
+    invalidate_decode_caches(decoder);
 
     /*
      * finally, copy some default fields into the decoder's state,
-     * faking-up initial te_inst support and discovery_response packets.
+     * faking-up initial te_inst support and discovery_response packets,
+     * and allocate (and initialize) the branch predictor lookup table,
+     * jump target cache, and return_stack[] to suit.
      */
     decoder->discovery_response = default_discovery_response;
     decoder->options = default_support_options;
     decoder->encoder_mode = TE_ENCODER_MODE_DELTA;
+    te_apply_discovery_response(decoder);
 
     return decoder;
 }
 
 
+/*
+ * Release all the memory allocated by te_open_trace_decoder(), for
+ * an instance of a trace-decoder, which is no longer required.
+ * This must be called exactly once for each trace-decoder opened,
+ * whether or not its memory was provided by the caller.
+ */
+void te_close_trace_decoder(
+    te_decoder_state_t * const decoder)
+{
+    assert(decoder);
+
+    free(decoder->decoded_cache);
+    decoder->decoded_cache = NULL;
+    free(decoder->cold_cache);
+    decoder->cold_cache = NULL;
+    free(decoder->basic_block_cache);
+    decoder->basic_block_cache = NULL;
+    free(decoder->cfg_cache);
+    decoder->cfg_cache = NULL;
+    free(decoder->pc_batch);
+    decoder->pc_batch = NULL;
+    free_predecoded_ranges(decoder->predecoded, decoder->num_predecoded);
+    decoder->predecoded = NULL;
+    decoder->num_predecoded = 0;
+#if TE_CONTEXT_CACHES
+    if (decoder->context_caches)
+    {
+        for (size_t i = 0; i < TE_CONTEXT_CACHES; i++)
+        {
+            struct te_context_caches_t * const caches = &decoder->context_caches[i];
+            free(caches->decoded_cache);
+            free(caches->cold_cache);
+            free(caches->basic_block_cache);
+            free(caches->cfg_cache);
+        }
+        free(decoder->context_caches);
+        decoder->context_caches = NULL;
+    }
+#endif  /* TE_CONTEXT_CACHES */
+    free(decoder->return_stack);
+    decoder->return_stack = NULL;
+    decoder->return_stack_entries = 0;
+    free(decoder->jump_target);
+    decoder->jump_target = NULL;
+    decoder->jump_target_entries = 0;
+    free(decoder->bpred.table);
+    decoder->bpred.table = NULL;
+    decoder->bpred.size = 0;
+
+    if (decoder->allocated)
+    {
+        free(decoder);
+    }
+}
+
+
+/*
+ * Size the return_stack[], jump_target[] and bpred.table[] arrays to
+ * suit the current decoder->discovery_response, rather than for the
+ * largest supported (TE_MAX_IRSTACK_DEPTH, TE_JUMP_TARGET_CACHE_SIZE,
+ * and TE_BRANCH_PREDICTOR_SIZE entries respectively).
+ *
+ * This is called when the trace-decoder is opened, and on receipt of
+ * each te_inst synchronization support packet. So, if the user modifies
+ * decoder->discovery_response after opening, then this need only be
+ * called explicitly if it is to take effect before the next support
+ * packet. Any array which changes size is re-initialized.
+ */
+void te_apply_discovery_response(
+    te_decoder_state_t * const decoder)
+{
+    assert(decoder);
+    const te_discovery_response_t * const discovery_response =
+        &decoder->discovery_response;
+
+    /* the return_stack[] only needs to be as deep as the trace-encoder's */
+    const size_t return_stack_entries =
+        (discovery_response->return_stack_size) ?
+            (size_t)1 << discovery_response->return_stack_size :
+            (size_t)1 << discovery_response->call_counter_size;
+    assert(return_stack_entries <= TE_MAX_IRSTACK_DEPTH);
+    if (return_stack_entries != decoder->return_stack_entries)
+    {
+        free(decoder->return_stack);
+        decoder->return_stack = malloc(return_stack_entries * sizeof(te_address_t));
+        assert(decoder->return_stack);
+        decoder->return_stack_entries = return_stack_entries;
+        decoder->irstack_depth = 0;
+        decoder->irstack_top = 0;
+    }
+
+    decoder->jump_target = te_size_jump_target_cache(
+        decoder->jump_target,
+        &decoder->jump_target_entries,
+        discovery_response);
+
+    /* if re-initialized, a deferred branch predictor is now known */
+    const size_t bpred_size = decoder->bpred.size;
+    te_size_bpred_table(&decoder->bpred, discovery_response);
+    if (bpred_size != decoder->bpred.size)
+    {
+        decoder->bpred_deferred = false;
+    }
+}
+
+
 /*
  * if we have any yet, print out the decoded cache statistics
  */
@@ -1556,6 +3428,68 @@ void te_print_decoded_cache_statistics(
             decoder->num_hits, hits,
             decoder->num_gets,
             same + hits);
+
+        /* a miss which evicts a valid record is counted as a conflict */
+        const unsigned long misses =
+            decoder->num_gets - decoder->num_hits - decoder->num_same;
+        fprintf(decoder->debug_stream,
+            "decoded-cache: %lu x %u-way,  misses = %8lu,  conflict misses = %8lu (%5.2f%%)\n",
+            (unsigned long)decoder->decoded_cache_sets,
+            decoder->decoded_cache_ways,
+            misses,
+            decoder->num_conflicts,
+            (float)(decoder->num_conflicts)*100.0f/(float)decoder->num_gets);
+    }
+
+    if ((decoder->debug_stream) && (decoder->num_cold_gets))  /* ensure we do not divide by zero */
+    {
+        fprintf(decoder->debug_stream,
+            "cold-cache:    %lu slots,  hits = %8lu (%5.2f%%),  total = %8lu\n",
+            (unsigned long)decoder->cold_cache_slots,
+            decoder->num_cold_hits,
+            (float)(decoder->num_cold_hits)*100.0f/(float)decoder->num_cold_gets,
+            decoder->num_cold_gets);
+    }
+
+    if ((decoder->debug_stream) && (decoder->shared_image))
+    {
+        fprintf(decoder->debug_stream,
+            "shared-image:  hits = %8lu\n",
+            decoder->num_shared_hits);
+    }
+
+    if ((decoder->debug_stream) && (decoder->context_changes))
+    {
+        fprintf(decoder->debug_stream,
+            "contexts:      changes = %8" PRIu64 ",  misses = %8lu\n",
+            decoder->context_changes,
+            decoder->num_context_misses);
+    }
+
+    if ((decoder->debug_stream) && (decoder->num_block_gets))  /* ensure we do not divide by zero */
+    {
+        fprintf(decoder->debug_stream,
+            "block-cache:   hits = %8lu (%5.2f%%),  total = %8lu,  runs skipped = %8lu\n",
+            decoder->num_block_hits,
+            (float)(decoder->num_block_hits)*100.0f/(float)decoder->num_block_gets,
+            decoder->num_block_gets,
+            decoder->num_block_steps);
+    }
+
+    if ((decoder->debug_stream) && (decoder->num_loop_skips))
+    {
+        fprintf(decoder->debug_stream,
+            "loops:         skipped = %8lu,  iterations = %" PRIu64 "\n",
+            decoder->num_loop_skips,
+            decoder->num_loop_iterations);
+    }
+
+    if ((decoder->debug_stream) && (decoder->num_cfg_steps))
+    {
+        fprintf(decoder->debug_stream,
+            "cfg-cache:     multi-branch steps = %8lu (of %u branches each)\n",
+            decoder->num_cfg_steps,
+            TE_CFG_CHUNK_BITS);
     }
 }
 #endif  /* TE_WITH_STATISTICS */
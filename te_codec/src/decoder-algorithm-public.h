@@ -107,6 +107,10 @@ extern "C" {
  *     In this case both return_stack_size and
  *     call_counter_size shall be zero.
  *
+ * In the trace-decoder, the return_stack[] is circular, so that when
+ * it is full, the oldest entry is dropped (to make room for the newest)
+ * without moving any of the others.
+ *
  * If not defined elsewhere, define TE_MAX_IRSTACK_DEPTH here.
  */
 #if !defined(TE_MAX_IRSTACK_DEPTH)
@@ -147,7 +151,7 @@ extern "C" {
 
 /*
  * There is a relatively high cost of calling the function
- * te_get_and_disassemble_instr(), which is aliased to get_instr(),
+ * te_get_decoded_instr(), which is aliased to get_instr(),
  * and this function is called at lot! This function may need to:
  *  1) retrieve an instruction from an Elf binary (for a given address)
  *  2) decode the retrieved instruction (using riscv-disassembler)
@@ -160,20 +164,173 @@ extern "C" {
  * many times in short succession. The chosen solution is a pure software
  * cache, which does not map on to the trace encoder hardware at all.
  *
- * We create a simple (direct-mapped) cache of recent instruction decodes,
+ * We create a simple (set-associative) cache of recent instruction decodes,
  * using the array decoded_cache[] in the te_decoder_state_t structure.
- * This will hold 100% of the slots with 16-bit instructions, but only
- * 50% of the slots with 32-bit instructions, etcetera. As the "index"
+ * This will hold 100% of the sets with 16-bit instructions, but only
+ * 50% of the sets with 32-bit instructions, etcetera. As the "index"
  * is the bottom n-bits of the address (after shifting it right by one).
+ * The decoded_cache[] is dynamically allocated, and its size (and the
+ * number of ways in each set) may be chosen when the trace-decoder is
+ * opened, by calling te_open_trace_decoder_with_cache(). Otherwise, the
+ * defaults TE_DECODED_CACHE_BITS and TE_DECODED_CACHE_WAYS are used.
+ * Optionally, te_predecode_image() may be called (once for each range of
+ * addresses) to decode an entire (fixed) image once, in which case
+ * addresses in the image bypass the decoded_cache[] entirely.
+ *
+ * Each slot in decoded_cache[] is only a compact "hot" record, holding
+ * just the few fields which the decoder's predicates need. The complete
+ * decode (including the disassembly text line) is held in a second,
+ * (direct-mapped) "cold" cache, using the array cold_cache[], which is
+ * only consulted when the complete decode is actually required (e.g. by
+ * te_get_decoded_instr(), or for the advance_decoded_pc call-back).
+ * An entry in cold_cache[] which has been evicted is re-created, by
+ * calling get_instruction and the disassembler again. Unless a complete
+ * decode is required, the cold_cache[] only holds each instruction while
+ * its hot record is filled, so it is opened with just 2^TE_COLD_CACHE_BITS
+ * slots. The first call to te_get_decoded_instr() (which is also how each
+ * retired PC is found for the advance_decoded_pc and advance_decoded_pcs
+ * call-backs) grows it to 2^TE_OBSERVED_COLD_CACHE_BITS slots, which is
+ * the same size as the decode cache was, before it was split in two.
+ * Alternatively, its (fixed) size may be chosen by calling
+ * te_open_trace_decoder_with_cache(), in which case it never grows.
  *
- * We now define a few macros to dimension and map this decode cache.
+ * We now define a few macros to dimension and map these decode caches.
  * Note: a cache size of 2^10 resulted in a hit-rate of 99.12% for coremark!
+ * However, traces containing both an OS and user-space will alias badly
+ * in a direct-mapped cache, hence TE_DECODED_CACHE_WAYS.
  */
 #if !defined(TE_DECODED_CACHE_BITS)
-#   define TE_DECODED_CACHE_BITS    (10)        /* 2^10 = 1024 slots */
+#   define TE_DECODED_CACHE_BITS    (12)        /* 2^12 = 4096 slots */
 #endif  /* TE_DECODED_CACHE_BITS */
-#define TE_DECODED_CACHE_SIZE       (1u<<TE_DECODED_CACHE_BITS)
-#define TE_SLOT_NUMBER(address)     (((address)>>1)&(TE_DECODED_CACHE_SIZE-1u))
+#if !defined(TE_DECODED_CACHE_WAYS)
+#   define TE_DECODED_CACHE_WAYS    (2)         /* must be 1, 2 or 4 */
+#endif  /* TE_DECODED_CACHE_WAYS */
+
+#if !defined(TE_COLD_CACHE_BITS)
+#   define TE_COLD_CACHE_BITS       (6)         /* 2^6 = 64 slots */
+#endif  /* TE_COLD_CACHE_BITS */
+#if !defined(TE_OBSERVED_COLD_CACHE_BITS)
+#   define TE_OBSERVED_COLD_CACHE_BITS  (10)    /* 2^10 = 1024 slots */
+#endif  /* TE_OBSERVED_COLD_CACHE_BITS */
+
+
+/*
+ * In addition to the decoded cache, the trace-decoder maintains a
+ * second (direct-mapped) software cache of "basic blocks", using the
+ * array basic_block_cache[] in the te_decoder_state_t structure.
+ * Each block is keyed by the address of its first instruction, and
+ * describes the run of sequential instructions from that address up to
+ * and including the first instruction which might not be sequential
+ * (i.e. a branch, a jump, an uninferrable discontinuity, or any
+ * instruction which may trap, such as ecall, ebreak or a custom one).
+ * A block is also ended at the address up to which the caller is
+ * following the execution path, so no instruction beyond that
+ * address is fetched on its behalf.
+ * This allows follow_execution_path() to advance over a whole run
+ * of sequential instructions in one step, rather than calling
+ * get_instr() and all the predicates for each and every instruction.
+ *
+ * A basic block is truncated after TE_MAX_BLOCK_INSTRUCTIONS
+ * instructions, as the size of each instruction in a block is
+ * recorded as a single bit in a 64-bit mask.
+ *
+ * Note: building a basic block will call get_instruction for all the
+ * instructions in the block, some of which may not (yet) be retired.
+ */
+#if !defined(TE_BASIC_BLOCK_CACHE_BITS)
+#   define TE_BASIC_BLOCK_CACHE_BITS    (8)         /* 2^8 = 256 blocks */
+#endif  /* TE_BASIC_BLOCK_CACHE_BITS */
+#define TE_BASIC_BLOCK_CACHE_SIZE   (1u<<TE_BASIC_BLOCK_CACHE_BITS)
+#define TE_BLOCK_SLOT_NUMBER(address) (((address)>>1)&(TE_BASIC_BLOCK_CACHE_SIZE-1u))
+#define TE_MAX_BLOCK_INSTRUCTIONS   (64u)       /* bits in a uint64_t */
+
+
+/*
+ * Basic blocks which end with a conditional branch are also the nodes
+ * of a control-flow graph (CFG), with the taken and not-taken targets
+ * as the successor edges. The trace-decoder lazily builds a third
+ * (direct-mapped) software cache of these nodes, using the array
+ * cfg_cache[] in the te_decoder_state_t structure. Each node has a
+ * lookup table, indexed by the next TE_CFG_CHUNK_BITS bits of the
+ * branch_map, which records where the execution path ends up after
+ * following that many branches from the node. This allows the
+ * function follow_execution_path() to consume several bits of the
+ * branch_map in a single step, instead of one branch at a time.
+ *
+ * Note: this is only used when nobody is observing each PC, and when
+ * the branch predictor is not enabled, as the branch_map is then the
+ * only source of the taken/not-taken status of each branch.
+ */
+#if !defined(TE_CFG_CACHE_BITS)
+#   define TE_CFG_CACHE_BITS        (6)         /* 2^6 = 64 nodes */
+#endif  /* TE_CFG_CACHE_BITS */
+#define TE_CFG_CACHE_SIZE           (1u<<TE_CFG_CACHE_BITS)
+#define TE_CFG_SLOT_NUMBER(address) (((address)>>1)&(TE_CFG_CACHE_SIZE-1u))
+#if !defined(TE_CFG_CHUNK_BITS)
+#   define TE_CFG_CHUNK_BITS        (4)         /* 2^4 = 16 paths per node */
+#endif  /* TE_CFG_CHUNK_BITS */
+#define TE_CFG_CHUNK_SIZE           (1u<<TE_CFG_CHUNK_BITS)
+
+
+/*
+ * The maximum number of PCs in each batch passed to the (optional)
+ * call-back decoder->advance_decoded_pcs. A batch may be passed before
+ * it is full, for example, at the end of each te_inst packet.
+ */
+#if !defined(TE_PC_BATCH_SIZE)
+#   define TE_PC_BATCH_SIZE         (1024u)
+#endif  /* TE_PC_BATCH_SIZE */
+
+
+/*
+ * With the above defaults, on a 64-bit host, each trace-decoder
+ * allocates the following. Those marked "*" are decode caches, which
+ * are allocated once for each context with its own set of them (see
+ * TE_CONTEXT_CACHES below), and the rest once for each trace-decoder:
+ *
+ *  at open:
+ *      te_decoder_state_t                       < 1 KiB
+ *    * decoded_cache[]     4096 x 24 bytes       96 KiB
+ *    * cold_cache[]          64 x 128 bytes       8 KiB
+ *  on first use:
+ *    * cold_cache[]        1024 x 128 bytes     128 KiB  (instead, on the first te_get_decoded_instr())
+ *    * basic_block_cache[]  256 x 64 bytes       16 KiB  (once any path is followed)
+ *    * cfg_cache[]           64 x 392 bytes    24.5 KiB  (only if no bpred, and no PC is observed)
+ *      pc_batch[]          1024 x 24 bytes       24 KiB  (only with advance_decoded_pcs)
+ *  once the discovery_response is known:
+ *      return_stack[], jump_target[] and the bpred table,
+ *      each only as large as the trace-encoder's parameters need.
+ *
+ * That is, about 120 KiB (145 KiB without the branch predictor) per
+ * context when no PC is observed, but about 240 KiB per context when
+ * each PC is observed. Where many trace-decoders are open at once, the
+ * decoded_cache[] may also be made smaller, by calling the function
+ * te_open_trace_decoder_with_cache().
+ */
+
+
+/*
+ * The decode caches (decoded_cache[], cold_cache[], basic_block_cache[]
+ * and cfg_cache[]) hold instructions for a single context (e.g. an ASID),
+ * which is that reported in the most recent te_inst synchronization
+ * packet. When the context changes, the caches for the previous context
+ * are set aside, and those for the new context are re-instated, if they
+ * are one of the (up to) TE_CONTEXT_CACHES sets set aside. Otherwise, the
+ * least recently used set is re-used (and invalidated) for the new context.
+ * Zero means that the caches are simply invalidated whenever the context
+ * changes. Any predecoded image is never set aside nor invalidated, as it
+ * applies to all contexts (see te_predecode_image()).
+ *
+ * Each set aside is allocated the first time a context misses, and is
+ * as large as the caches for the current context (see above), so each
+ * costs another 120 KiB or so, for every trace-decoder. The default of
+ * one set aside is enough for a trace which alternates between two
+ * contexts (e.g. a process and the kernel). Traces which cycle through
+ * more contexts may define a larger value, at the cost of that memory.
+ */
+#if !defined(TE_CONTEXT_CACHES)
+#   define TE_CONTEXT_CACHES        (1u)
+#endif  /* TE_CONTEXT_CACHES */
 
 
 /*
@@ -283,6 +440,7 @@ typedef enum
     TE_ERROR_IMPLICT_EXCEPTION,
     TE_ERROR_NOT_FORMAT3,
     TE_ERROR_INVALID_PACKET,
+    TE_ERROR_UNRESOLVED_BPRED,  /* see te_defer_bpred_table() */
     TE_ERROR_NUM_ERRORS         /* must be last in list */
 } te_error_code_t;
 
@@ -304,6 +462,121 @@ typedef struct
 } te_decoded_instruction_t;
 
 
+/*
+ * enumerate the classes to which an instruction may belong, as used by
+ * the predicates (e.g. is_branch()) of the decoder. These are bit-masks,
+ * as an instruction may belong to several classes at once, for example
+ * "c.jalr" is both an uninferrable jump, and a call.
+ */
+typedef enum
+{
+    TE_CLASS_BRANCH             = 1u<<0,    /* a conditional branch */
+    TE_CLASS_INFERRABLE_JUMP    = 1u<<1,    /* jal, c.jal, c.j, jalr with rs1==0 */
+    TE_CLASS_UNINFERRABLE_JUMP  = 1u<<2,    /* jalr with rs1!=0, c.jalr, c.jr */
+    TE_CLASS_UNINFERRABLE_DISCON= 1u<<3,    /* uninferrable jump, or xRET */
+    TE_CLASS_CALL               = 1u<<4,    /* a jump which writes x1 */
+    TE_CLASS_RETURN             = 1u<<5,    /* jalr x0,x1 or c.jr x1 */
+    TE_CLASS_UPPER_IMMEDIATE    = 1u<<6,    /* auipc, lui or c.lui */
+    TE_CLASS_AUIPC              = 1u<<7     /* auipc */
+} te_instruction_class_t;
+
+
+/*
+ * The following structure is the compact "hot" record for a single
+ * RISC-V instruction, as held in the decoded_cache[] array. It holds
+ * a copy of just those fields of te_decoded_instruction_t which are
+ * used by the decoder to follow the execution path, together with the
+ * set of classes (te_instruction_class_t) of the instruction, which is
+ * calculated once, when the record is inserted in the cache.
+ */
+typedef struct
+{
+    te_address_t   pc;         /* address of the instruction */
+    int32_t        imm;        /* immediate, as decode.imm */
+    uint16_t       op;         /* opcode, as decode.op */
+    uint8_t        rd;         /* destination register, as decode.rd */
+    uint8_t        rs1;        /* 1st source register, as decode.rs1 */
+    uint8_t        length;     /* instruction size (in bytes) */
+    uint8_t        classes;    /* bit-mask of te_instruction_class_t */
+    bool           custom;     /* true if a custom instruction */
+} te_hot_instruction_t;
+
+
+/*
+ * The following structure is one contiguous range of addresses,
+ * predecoded by te_predecode_image(), with one hot record for each
+ * half-word. A record whose "pc" is TE_SENTINEL_BAD_ADDRESS has not
+ * (yet) been decoded, and is decoded the first time it is used.
+ */
+typedef struct
+{
+    te_address_t           base;       /* address of records[0] */
+    size_t                 count;      /* number of half-words */
+    te_hot_instruction_t * records;    /* [count] */
+} te_predecoded_range_t;
+
+
+/*
+ * enumerate the class of the instruction which terminates a basic block
+ */
+typedef enum
+{
+    TE_BLOCK_END_BRANCH = 0,            /* a conditional branch */
+    TE_BLOCK_END_INFERRABLE_JUMP = 1,   /* an inferrable jump (including calls) */
+    TE_BLOCK_END_UNINFERRABLE = 2,      /* an uninferrable discontinuity */
+    TE_BLOCK_END_LIMIT = 3,             /* a sequential instruction, block is full */
+    TE_BLOCK_END_TRAP = 4,              /* an instruction which may trap */
+    TE_BLOCK_END_STOP = 5               /* the address at which the caller stops */
+} te_block_end_t;
+
+
+/*
+ * The following structure is used to hold one basic block,
+ * that is a run of sequential instructions, ending with the
+ * first instruction that may not be sequential.
+ * See the comment for TE_BASIC_BLOCK_CACHE_BITS above.
+ */
+typedef struct
+{
+    te_address_t start;         /* address of the first instruction (the key) */
+    te_address_t last;          /* address of the terminating instruction */
+    te_address_t penultimate;   /* address of the instruction before "last" */
+    te_address_t taken;         /* target of a branch, or of an inferrable jump */
+    te_address_t not_taken;     /* address spatially following "last" */
+    uint64_t     wide;          /* bit [n] is set if the n-th instruction is 32-bit */
+    unsigned     length;        /* block size (in bytes), including "last" */
+    unsigned     count;         /* number of instructions, including "last" */
+    te_block_end_t end;         /* the class of the instruction at "last" */
+} te_basic_block_t;
+
+
+/*
+ * The following structure is used to hold the result of following
+ * TE_CFG_CHUNK_BITS branches from a CFG node, for one pattern of bits
+ * in the branch_map. See the comment for TE_CFG_CACHE_BITS above.
+ */
+typedef struct
+{
+    te_address_t pc;            /* address after the last branch followed */
+    te_address_t last_pc;       /* address of the last branch followed */
+    uint32_t     instructions;  /* number of instructions retired */
+    uint8_t      taken;         /* number of taken branches */
+    bool         valid;         /* true if this entry has been built */
+    bool         usable;        /* false if not every block ends with a branch */
+} te_cfg_path_t;
+
+
+/*
+ * The following structure is used to hold one CFG node, which is
+ * keyed by the address of the first instruction in its basic block.
+ */
+typedef struct
+{
+    te_address_t  start;        /* address of the first instruction (the key) */
+    te_cfg_path_t paths[TE_CFG_CHUNK_SIZE];     /* indexed by branch_map bits */
+} te_cfg_node_t;
+
+
 /*
  * The following is used to cache a sub-set of the fields in the
  * discovery_response packet for this Trace-Encoder IP block.
@@ -451,7 +724,8 @@ typedef struct
     uint64_t correct_predictions;  /* maximum value is 2^32 - 1 + 31 */
 
     /* the following is actually of type te_bpred_state_t */
-    uint8_t table[TE_BRANCH_PREDICTOR_SIZE];
+    uint8_t * table;    /* [size] */
+    size_t size;        /* 2^branch_prediction_size entries */
 
     /* should the branch predictor use branch-map[0] first ? */
     bool use_bmap_first;
@@ -570,7 +844,15 @@ typedef struct te_inst_t
  *
  *  1) retrieve the raw binary instruction value,
  *     and its length, at a given address
- *     [This is NOT optional, and must be provided.]
+ *     [This is NOT optional, and must be provided, unless 1b is.]
+ *
+ *  1b) as 1 above, but also passed the context (e.g. ASID) reported in
+ *     the most recent te_inst synchronization packet, for users tracing
+ *     many address spaces (see te-address-space.h). If provided, this is
+ *     used instead of 1 above.
+ *     [This is optional, and need not be provided. If provided, it
+ *     should be assigned to decoder->get_context_instruction after opening,
+ *     and then get_instruction may be NULL when opening.]
  *
  *  2) provide any required support for using custom RISC-V
  *     instructions. For non-custom instruction, this does
@@ -581,6 +863,30 @@ typedef struct te_inst_t
  *  3) notify the user that the PC has been updated
  *     [This is optional, and need not be provided.]
  *
+ *  3b) as 3 above, but notify the user of a batch of "count" updates
+ *     of the PC at once, each as an old_pc, new_pc, and a pointer to
+ *     the new instruction. The batch is passed when it is full, at the
+ *     end of each te_inst packet, and when the context changes (see
+ *     te_flush_decoded_pcs()). Each instruction points into the
+ *     cold_cache[], so the batch is also passed before a miss in the
+ *     cold_cache[] replaces any of them.
+ *     [This is optional, and need not be provided. If provided, it
+ *     should be assigned to decoder->advance_decoded_pcs after opening.]
+ *
+ *  3c) as 3 above, but notify the user once per run of sequential
+ *     instructions, rather than once per instruction. A run is only
+ *     passed once it has ended (i.e. the next PC is not sequential),
+ *     or when te_flush_decoded_run() is called.
+ *     [This is optional, and need not be provided. If provided, it
+ *     should be assigned to decoder->advance_decoded_run after opening.]
+ *
+ *  4) notify the user that the sequence of PCs from first_pc to
+ *     last_pc (inclusive) was repeated a further "iterations" times,
+ *     without notifying each of these PCs individually (as 3 above).
+ *     Each iteration retires "instructions" instructions.
+ *     [This is optional, and need not be provided. If provided, it
+ *     should be assigned to decoder->loop_repeated after opening.]
+ *
  * Users of this code are expected to implement each of
  * the (non-optional) functions as appropriate, and pass
  * pointers to them when te_open_trace_decoder() is called.
@@ -595,6 +901,12 @@ typedef unsigned (te_get_instruction_t)(
     const te_address_t address,
     rv_inst * const instruction);
 
+typedef unsigned (te_get_context_instruction_t)(
+    void * const user_data,
+    const uint32_t context,
+    const te_address_t address,
+    rv_inst * const instruction);
+
 typedef void (te_do_custom_instruction_t)(
     void * const user_data,
     te_decoded_instruction_t * const instr);
@@ -605,6 +917,82 @@ typedef void (te_advance_decoded_pc_t)(
     const te_address_t new_pc,
     const te_decoded_instruction_t * const new_instruction);
 
+/* one entry in the batch passed to te_advance_decoded_pcs_t */
+typedef struct
+{
+    te_address_t old_pc;
+    te_address_t new_pc;
+    const te_decoded_instruction_t * instr;     /* at new_pc */
+} te_decoded_pc_t;
+
+typedef void (te_advance_decoded_pcs_t)(
+    void * const user_data,
+    const te_decoded_pc_t * const pcs,
+    const size_t count);
+
+/*
+ * enumerate how a run of sequential instructions ended, that is, the
+ * class of the last instruction in the run, given that it was followed
+ * by a non-sequential PC. TE_RUN_END_OTHER is used if the instruction
+ * is not a control transfer instruction, e.g. if it was followed by
+ * an exception, or a re-synchronization. TE_RUN_END_FLUSH is used if
+ * the run was passed by te_flush_decoded_run(), before it ended.
+ */
+typedef enum
+{
+    TE_RUN_END_TAKEN_BRANCH = 0,    /* a taken conditional branch */
+    TE_RUN_END_JUMP = 1,            /* an inferrable jump (including calls) */
+    TE_RUN_END_UNINFERRABLE = 2,    /* an uninferrable discontinuity */
+    TE_RUN_END_OTHER = 3,           /* any other instruction */
+    TE_RUN_END_FLUSH = 4            /* not ended, but flushed */
+} te_run_end_t;
+
+/* one run of sequential instructions, as passed to te_advance_decoded_run_t */
+typedef struct
+{
+    te_address_t first_pc;      /* address of the first instruction */
+    te_address_t last_pc;       /* address of the last instruction */
+    uint64_t     count;         /* number of instructions, including both */
+    te_run_end_t end;           /* how the run ended */
+} te_decoded_run_t;
+
+typedef void (te_advance_decoded_run_t)(
+    void * const user_data,
+    const te_decoded_run_t * const run);
+
+typedef void (te_loop_repeated_t)(
+    void * const user_data,
+    const te_address_t first_pc,
+    const te_address_t last_pc,
+    const uint64_t iterations,
+    const uint64_t instructions);
+
+
+/*
+ * The following structure is used to detect when the reconstructed
+ * execution path becomes periodic, whilst following a (potentially
+ * very long) run of correctly predicted branches. This uses Brent's
+ * cycle detection algorithm, with the "anchor" being a branch, and
+ * the length of the cycle being measured in branches.
+ *
+ * A cycle may only be skipped if every branch in it was correctly
+ * predicted from a saturated state (TE_BPRED_00 or TE_BPRED_11), as
+ * then none of the branch predictor's states change, and if nothing
+ * in it touched the implicit return stack.
+ */
+#if !defined(TE_LOOP_MAX_BRANCHES)
+#   define TE_LOOP_MAX_BRANCHES     (1024u)     /* longest cycle detected */
+#endif  /* TE_LOOP_MAX_BRANCHES */
+typedef struct
+{
+    te_address_t anchor;        /* address of the anchor branch */
+    uint64_t     power;         /* branches until the anchor is moved */
+    uint64_t     length;        /* branches since the anchor */
+    uint64_t     taken;         /* taken branches since the anchor */
+    uint64_t     retired;       /* instructions retired since the anchor */
+    bool         periodic;      /* false if anything since the anchor prevents a skip */
+} te_loop_t;
+
 
 /*
  * The following structure is used to hold all the state
@@ -615,6 +1003,13 @@ typedef void (te_advance_decoded_pc_t)(
  */
 typedef struct te_decoder_state_t
 {
+    /*
+     * The fields are ordered by how often they are accessed. The
+     * following are accessed for (almost) every instruction, and should
+     * all fit in the first two cache lines, whilst the large tables are
+     * all allocated separately, when the trace-decoder is opened.
+     */
+
     /* Reconstructed program counter */
     te_address_t pc;
     /* PC of previously retired instruction */
@@ -628,13 +1023,88 @@ typedef struct te_decoder_state_t
     /* Flag to indicate that reported address from format != 3 was
      * not following an uninferrable jump (and is therefore inferred) */
     bool inferred_address;
-    /* true if 1st trace packet still to be processed */
-    bool start_of_trace;
+    /* Flag to indicate the context is to change on reaching the reported
+     * address of a start packet, and if its instruction (if a branch) is
+     * then to be counted as 1 unprocessed branch */
+    bool context_pending;
+    bool count_start_branch;
+
+    /*
+     * if true, each entry in bpred.table[] is not a te_bpred_state_t,
+     * but is instead a map from the (unknown) state of that entry when
+     * te_defer_bpred_table() was called, to its current state.
+     * See te_defer_bpred_table() and te_resolve_bpred_table().
+     */
+    bool bpred_deferred;
+
+    /* see comment above for an explanation of these decode caches */
+    te_hot_instruction_t * decoded_cache;  /* [sets * ways] */
+    size_t decoded_cache_sets;          /* number of sets (a power of 2) */
+    unsigned decoded_cache_ways;        /* number of ways in each set */
+
+    /*
+     * set of run-time configuration "option" bits from the most
+     * recently received te_inst synchronization support packet
+     */
+    te_options_t        options;
+
+    /* optional dense predecode of images for all contexts, see te_predecode_image() */
+    te_predecoded_range_t * predecoded; /* [num_predecoded], in address order */
+    size_t num_predecoded;              /* number of ranges */
+    size_t predecoded_hit;              /* index of the range last found */
+
+    /* set of function pointers for per-instruction call-backs */
+    te_advance_decoded_pc_t    * advance_decoded_pc;
+    te_advance_decoded_pcs_t   * advance_decoded_pcs;
+    te_advance_decoded_run_t   * advance_decoded_run;
+
+    /* the FILE I/O stream to which to write all debug info */
+    FILE * debug_stream;
+
+    /* the set of active debug flags (OR-ed together) */
+    unsigned int debug_flags;
+
+    /* error code, if an unrecoverable error was encountered */
+    te_error_code_t error_code;
+
+    /* batch of PCs waiting to be passed to advance_decoded_pcs */
+    size_t pc_batch_count;
+    te_decoded_pc_t * pc_batch;     /* [TE_PC_BATCH_SIZE], allocated on first use */
+
+    /*
+     * The following are accessed for every branch, call or return,
+     * or for every run of instructions.
+     */
+
+    /* following used only if we enable a branch predictor */
+    te_bpred_t bpred;
+
+    /* see comment above for an explanation of this loop detector */
+    te_loop_t loop;
 
-    /* array holding return address stack (only when "implicit_return" is 1) */
-    te_address_t return_stack[TE_MAX_IRSTACK_DEPTH];
     /* depth of the return address stack, zero == stack is empty */
     size_t irstack_depth;
+    /* index of the next push (modulo return_stack_entries) in return_stack[] */
+    size_t irstack_top;
+    /* array holding return address stack (only when "implicit_return" is 1) */
+    te_address_t * return_stack;    /* [return_stack_entries], circular */
+    /* maximum depth of the return address stack, zero if none */
+    size_t return_stack_entries;
+
+    /* the current run of sequential PCs, for advance_decoded_run */
+    te_decoded_run_t run;       /* "run.count" is zero, if none */
+    te_address_t run_next_pc;   /* address following "run.last_pc" */
+    uint8_t run_last_classes;   /* classes of the instruction at "run.last_pc" */
+
+    /* see comment above for an explanation of these caches */
+    te_basic_block_t * basic_block_cache;   /* [TE_BASIC_BLOCK_CACHE_SIZE], allocated on first use */
+    te_cfg_node_t * cfg_cache;              /* [TE_CFG_CACHE_SIZE], allocated on first use */
+    te_loop_repeated_t * loop_repeated;
+
+    /*
+     * The following are accessed for every te_inst packet,
+     * or for every miss in the decoded_cache[].
+     */
 
     /*
      * Following is the "normalized" (i.e. un-shifted, non-differential) address
@@ -644,62 +1114,99 @@ typedef struct te_decoder_state_t
      */
     te_address_t last_sent_addr;
 
-    /* fields from the discovery_response packets */
-    te_discovery_response_t discovery_response;
+    /* number of non-sync packets received, since last sync packet */
+    uint32_t non_sync_packets;
 
-    /*
-     * set of run-time configuration "option" bits from the most
-     * recently received te_inst synchronization support packet
-     */
-    te_options_t        options;
-    te_encoder_mode_t   encoder_mode;
+    /* true if 1st trace packet still to be processed */
+    bool start_of_trace;
 
     /* the most recent privilege level reported */
     uint8_t privilege;      /* up to 4-bits */
 
+    /* the most recent context reported, to which the decode caches belong */
+    uint32_t context;       /* up to 32-bits */
+
+    te_encoder_mode_t   encoder_mode;
+
+    /*
+     * fields from the discovery_response packets.
+     * The sizes of return_stack[], jump_target[] and bpred.table[]
+     * follow these, on each te_inst synchronization support packet,
+     * or on calling te_apply_discovery_response().
+     */
+    te_discovery_response_t discovery_response;
+
+    /* allocate memory for a "jump target cache" */
+    te_address_t * jump_target;     /* [jump_target_entries] */
+    size_t jump_target_entries;     /* 2^jump_target_cache_size entries */
+
     /* pointer to user-data, whatever was passed to te_open_trace_decoder() */
     void * user_data;
 
-    /* set of function pointers for call-backs */
+    /* set of function pointers for the remaining call-backs */
     te_get_instruction_t       * get_instruction;
+    te_get_context_instruction_t * get_context_instruction;
     te_do_custom_instruction_t * do_custom_instruction;
-    te_advance_decoded_pc_t    * advance_decoded_pc;
 
     /* the ISA to use (for riscv-disassembler) */
     rv_isa isa;
 
-    /* allocate memory for a "jump target cache" */
-    te_address_t jump_target[TE_JUMP_TARGET_CACHE_SIZE];
+    /* see comment above for an explanation of the cold cache */
+    te_decoded_instruction_t * cold_cache;  /* [cold_cache_slots] */
+    size_t cold_cache_slots;            /* number of slots (a power of 2) */
+    size_t cold_cache_open_slots;       /* number of slots for each new context */
+    size_t cold_cache_observed_slots;   /* number to grow to, or 0 if fixed */
 
-    /* following used only if we enable a branch predictor */
-    te_bpred_t bpred;
+    /*
+     * the decode caches set aside for other contexts, and the number of
+     * context changes, used to find the least recently used of these.
+     * See the comment for TE_CONTEXT_CACHES above.
+     */
+    struct te_context_caches_t * context_caches;    /* [TE_CONTEXT_CACHES] */
+    uint64_t context_changes;
+
+    /*
+     * optional store of hot records shared by many trace-decoders,
+     * and a namespace to use for it (e.g. to distinguish the images
+     * of different processes). See te-shared-image.h.
+     * These should be assigned after opening, and are NULL and 0 by default.
+     * Records are keyed by both shared_context, and the context reported
+     * in the most recent te_inst synchronization packet.
+     */
+    struct te_shared_image_t * shared_image;
+    uint32_t shared_context;
+
+    /* true if the memory for this structure was allocated when opened */
+    bool allocated;
 
     /* collection of various counters, to generate statistics */
 #if defined(TE_WITH_STATISTICS)
     te_statistics_t statistics;
-#endif  /* TE_WITH_STATISTICS */
 
-    /* number of non-sync packets received, since last sync packet */
-    uint32_t non_sync_packets;
-
-    /* see comment above for an explanation of this decode cache */
-    te_decoded_instruction_t decoded_cache[TE_DECODED_CACHE_SIZE];
-
-    /* maintain a few statistics about decoded_cache[] */
-#if defined(TE_WITH_STATISTICS)
+    /* maintain a few statistics about decoded_cache[] and cold_cache[] */
     unsigned long num_gets;
     unsigned long num_same;
     unsigned long num_hits;
-#endif  /* TE_WITH_STATISTICS */
+    unsigned long num_conflicts;
+    unsigned long num_cold_gets;
+    unsigned long num_cold_hits;
+    unsigned long num_shared_hits;
 
-    /* the FILE I/O stream to which to write all debug info */
-    FILE * debug_stream;
+    /* maintain a few statistics about context changes */
+    unsigned long num_context_misses;
 
-    /* the set of active debug flags (OR-ed together) */
-    unsigned int debug_flags;
+    /* maintain a few statistics about basic_block_cache[] */
+    unsigned long num_block_gets;
+    unsigned long num_block_hits;
+    unsigned long num_block_steps;
 
-    /* error code, if an unrecoverable error was encountered */
-    te_error_code_t error_code;
+    /* maintain a few statistics about cfg_cache[] */
+    unsigned long num_cfg_steps;
+
+    /* maintain a few statistics about skipped loops */
+    unsigned long num_loop_skips;
+    uint64_t num_loop_iterations;
+#endif  /* TE_WITH_STATISTICS */
 } te_decoder_state_t;
 
 
@@ -711,6 +1218,16 @@ extern void te_process_te_inst(
     te_decoder_state_t * const decoder,
     const te_inst_t * const te_inst);
 
+/*
+ * Compatibility note: te_open_trace_decoder() (and its variants) always
+ * allocate the decode caches, and other tables, dynamically, even when
+ * "decoder" points to memory provided by the caller. Hence, the function
+ * te_close_trace_decoder() MUST be called exactly once, for every
+ * trace-decoder opened, once it is no longer required. It releases the
+ * instance itself too, if that was allocated when opened, so it should
+ * be called instead of free(). Callers which only call free(), as was
+ * previously required, will leak all these tables.
+ */
 extern te_decoder_state_t * te_open_trace_decoder(
     te_decoder_state_t * decoder,
     te_get_instruction_t * const get_instruction,
@@ -719,11 +1236,55 @@ extern te_decoder_state_t * te_open_trace_decoder(
     void * const user_data,
     const rv_isa isa);
 
+extern te_decoder_state_t * te_open_trace_decoder_with_cache(
+    te_decoder_state_t * decoder,
+    te_get_instruction_t * const get_instruction,
+    te_do_custom_instruction_t * const do_custom_instruction,
+    te_advance_decoded_pc_t * const advance_decoded_pc,
+    void * const user_data,
+    const rv_isa isa,
+    const unsigned cache_bits,
+    const unsigned cache_ways,
+    const unsigned cold_bits);
+
+extern void te_close_trace_decoder(
+    te_decoder_state_t * const decoder);
+
+extern void te_apply_discovery_response(
+    te_decoder_state_t * const decoder);
+
+extern void te_predecode_image(
+    te_decoder_state_t * const decoder,
+    const te_address_t base,
+    const size_t size);
+
 #if defined(TE_WITH_STATISTICS)
 extern void te_print_decoded_cache_statistics(
     const te_decoder_state_t * const decoder);
 #endif  /* TE_WITH_STATISTICS */
 
+extern void te_defer_bpred_table(
+    te_decoder_state_t * const decoder);
+
+extern void te_resolve_bpred_table(
+    te_decoder_state_t * const decoder,
+    const uint8_t * const initial);
+
+extern void te_resolve_bpred_map(
+    uint8_t * const map,
+    const size_t size,
+    const uint8_t * const initial);
+
+extern void te_flush_decoded_pcs(
+    te_decoder_state_t * const decoder);
+
+extern void te_flush_decoded_run(
+    te_decoder_state_t * const decoder);
+
+extern const te_decoded_instruction_t * te_get_decoded_instr(
+    te_decoder_state_t * const decoder,
+    const te_address_t address);
+
 extern te_decoded_instruction_t * te_get_and_disassemble_instr(
     te_decoder_state_t * const decoder,
     const te_address_t address,
@@ -403,7 +403,7 @@ static void send_te_inst_sync(
     /* invalidate the entire jump target cache, if enabled */
     if (encoder->options.jump_target_cache)
     {
-        memset(encoder->jump_target, 0, sizeof(encoder->jump_target));
+        memset(encoder->jump_target, 0, encoder->jump_target_entries * sizeof(te_address_t));
     }
 
     /* send the completed te_inst packet downstream */
@@ -456,6 +456,25 @@ static void send_te_inst_sync(
 }
 
 
+/*
+ * Size the jump_target[] and bpred.table[] arrays to suit the current
+ * encoder->discovery_response, rather than for the largest supported.
+ * Any array which changes size is re-initialized.
+ */
+static void size_encoder_state(
+    te_encoder_state_t * const encoder)
+{
+    assert(encoder);
+
+    encoder->jump_target = te_size_jump_target_cache(
+        encoder->jump_target,
+        &encoder->jump_target_entries,
+        &encoder->discovery_response);
+
+    te_size_bpred_table(&encoder->bpred, &encoder->discovery_response);
+}
+
+
 /*
  * Send a te_inst synchronization support packet.
  *
@@ -473,6 +492,9 @@ void te_send_te_inst_sync_support(
 {
     assert(encoder);
 
+    /* follow any changes the user has made to the discovery_response */
+    size_encoder_state(encoder);
+
     /* send the support te_inst packet */
     send_te_inst_sync(encoder,
         TE_INST_SUBFORMAT_SUPPORT,
@@ -1176,9 +1198,11 @@ static void clock_the_encoder(
  * allocated, otherwise it must point to a pre-allocated region large enough.
  * This returns a pointer to the internal "state" of the trace-encoder.
  *
- * If this function allocated memory (encoder==NULL on entry), the memory
- * should be released (by calling free()), when the instance of the
- * trace-encoder is no longer required.
+ * The jump_target[] and bpred.table[] arrays are always dynamically
+ * allocated, even if "encoder" is not NULL, so te_close_trace_encoder()
+ * MUST be called when the instance of the trace-encoder is no longer
+ * required. This also releases the memory for the instance itself, if
+ * it was allocated here (encoder==NULL), so do not call free() on it.
  */
 te_encoder_state_t * te_open_trace_encoder(
     te_encoder_state_t * encoder,
@@ -1186,6 +1210,8 @@ te_encoder_state_t * te_open_trace_encoder(
     te_prefer_jtc_extension_t * prefer_jtc_extension,
     void * const user_data)
 {
+    bool allocated = false;
+
     if (encoder)
     {
         /* use provided memory, but zero it for ONE trace-encoder instance */
@@ -1196,8 +1222,11 @@ te_encoder_state_t * te_open_trace_encoder(
         /* allocate (and zero) memory for ONE trace-encoder instance */
         encoder = calloc(1, sizeof(te_encoder_state_t));
         assert(encoder);
+        allocated = true;
     }
 
+    encoder->allocated = allocated;
+
     /* copy all the call-back function pointers provided */
     encoder->emit_te_inst = emit_te_inst;
     encoder->prefer_jtc_extension = prefer_jtc_extension;
@@ -1212,23 +1241,47 @@ te_encoder_state_t * te_open_trace_encoder(
     encoder->last_sent_addr = TE_SENTINEL_BAD_ADDRESS;
     encoder->decoders_pc = TE_SENTINEL_BAD_ADDRESS;
 
-    /* initialize the branch predictor lookup table */
-    te_initialize_bpred_table(&encoder->bpred);
-
     /*
      * finally, copy some default fields into the encoder's state,
      * faking-up initial support, discovery_response and
-     * set_trace packets.
+     * set_trace packets, and allocate (and initialize) the branch
+     * predictor lookup table, and jump target cache to suit.
      */
     encoder->discovery_response = default_discovery_response;
     encoder->options = default_support_options;
     encoder->set_trace = default_set_trace;
     encoder->encoder_mode = default_set_trace.encoder_mode;
+    size_encoder_state(encoder);
 
     return encoder;
 }
 
 
+/*
+ * Release all the memory allocated by te_open_trace_encoder(), for
+ * an instance of a trace-encoder, which is no longer required.
+ * This must be called exactly once for each trace-encoder opened,
+ * whether or not its memory was provided by the caller.
+ */
+void te_close_trace_encoder(
+    te_encoder_state_t * const encoder)
+{
+    assert(encoder);
+
+    free(encoder->jump_target);
+    encoder->jump_target = NULL;
+    encoder->jump_target_entries = 0;
+    free(encoder->bpred.table);
+    encoder->bpred.table = NULL;
+    encoder->bpred.size = 0;
+
+    if (encoder->allocated)
+    {
+        free(encoder);
+    }
+}
+
+
 /*
  * Process a single trace-encoder cycle.
  * Called each time an instruction retires, or generates an exception.
@@ -158,7 +158,11 @@ typedef struct te_encoder_state_t
     size_t next_slot;       /* index into 'stage' - next one to be discarded/reused */
     unsigned int pipeline_depth;    /* number of stages currently in use */
 
-    /* fields from the discovery_response packets */
+    /*
+     * fields from the discovery_response packets.
+     * The sizes of jump_target[] and bpred.table[] follow these,
+     * on each te_inst synchronization support packet sent.
+     */
     te_discovery_response_t discovery_response;
 
     /*
@@ -182,7 +186,8 @@ typedef struct te_encoder_state_t
     te_prefer_jtc_extension_t * prefer_jtc_extension;
 
     /* allocate memory for a "jump target cache" */
-    te_address_t jump_target[TE_JUMP_TARGET_CACHE_SIZE];
+    te_address_t * jump_target;     /* [jump_target_entries] */
+    size_t jump_target_entries;     /* 2^jump_target_cache_size entries */
 
     /* following used only if we enable a branch predictor */
     te_bpred_t bpred;
@@ -197,6 +202,9 @@ typedef struct te_encoder_state_t
 
     /* the set of active debug flags (OR-ed together) */
     unsigned int debug_flags;
+
+    /* true if the memory for this structure was allocated when opened */
+    bool allocated;
 } te_encoder_state_t;
 
 
@@ -208,12 +216,25 @@ extern void te_encode_one_irecord(
     te_encoder_state_t * const encoder,
     const te_instruction_record_t * const irecord);
 
+/*
+ * Compatibility note: te_open_trace_encoder() always allocates the
+ * jump_target[] and bpred.table[] arrays dynamically, even when
+ * "encoder" points to memory provided by the caller. Hence, the function
+ * te_close_trace_encoder() MUST be called exactly once, for every
+ * trace-encoder opened, once it is no longer required. It releases the
+ * instance itself too, if that was allocated when opened, so it should
+ * be called instead of free(). Callers which only call free(), as was
+ * previously required, will leak both arrays.
+ */
 extern te_encoder_state_t * te_open_trace_encoder(
     te_encoder_state_t * encoder,
     te_emit_te_inst_t * emit_te_inst,
     te_prefer_jtc_extension_t * prefer_jtc_extension,
     void * const user_data);
 
+extern void te_close_trace_encoder(
+    te_encoder_state_t * const encoder);
+
 /*
  * Send a te_inst synchronization support packet.
  *
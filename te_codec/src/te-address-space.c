@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2020 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "te-address-space.h"
+
+
+/*
+ * The interval index for one context (or for all contexts), that is
+ * an array of non-overlapping mappings, sorted by their first address.
+ */
+typedef struct
+{
+    uint32_t context;
+    te_address_mapping_t * mappings;    /* [num_mappings] */
+    size_t num_mappings;
+} te_context_map_t;
+
+
+struct te_address_space_t
+{
+    /* the maps for each individual context, sorted by context */
+    te_context_map_t * contexts;        /* [num_contexts] */
+    size_t num_contexts;
+
+    /* the map for all contexts, searched after that for the context */
+    te_context_map_t all_contexts;
+};
+
+
+/*
+ * Return the index of the first element in "map" whose first address
+ * is strictly greater than "address", or "map->num_mappings" if none.
+ */
+static size_t find_mapping_index(
+    const te_context_map_t * const map,
+    const te_address_t address)
+{
+    assert(map);
+
+    size_t lo = 0;
+    size_t hi = map->num_mappings;
+
+    while (lo < hi)
+    {
+        const size_t mid = lo + ((hi - lo) >> 1);
+
+        if (map->mappings[mid].first <= address)
+        {
+            lo = mid + 1u;  /* use the upper half */
+        }
+        else
+        {
+            hi = mid;       /* use the lower half */
+        }
+    }
+
+    return lo;
+}
+
+
+/*
+ * Return the index of the map for "context" in "space->contexts[]",
+ * if it exists, otherwise the index at which it should be inserted.
+ */
+static size_t find_context_index(
+    const te_address_space_t * const space,
+    const uint32_t context)
+{
+    assert(space);
+
+    size_t lo = 0;
+    size_t hi = space->num_contexts;
+
+    while (lo < hi)
+    {
+        const size_t mid = lo + ((hi - lo) >> 1);
+
+        if (space->contexts[mid].context < context)
+        {
+            lo = mid + 1u;  /* use the upper half */
+        }
+        else
+        {
+            hi = mid;       /* use the lower half */
+        }
+    }
+
+    return lo;
+}
+
+
+/*
+ * Return the mapping in "map" containing "address", or NULL if none.
+ */
+static const te_address_mapping_t * find_mapping(
+    const te_context_map_t * const map,
+    const te_address_t address)
+{
+    const size_t index = find_mapping_index(map, address);
+
+    if (index)
+    {
+        const te_address_mapping_t * const mapping = &map->mappings[index - 1u];
+        if (address - mapping->first < mapping->size)
+        {
+            return mapping;
+        }
+    }
+
+    return NULL;    /* not in any mapping */
+}
+
+
+/*
+ * Create a new (empty) address space, which should be released
+ * with te_close_address_space(), once no trace-decoders are using it.
+ */
+te_address_space_t * te_open_address_space(void)
+{
+    te_address_space_t * const space = calloc(1, sizeof(te_address_space_t));
+    assert(space);
+
+    return space;
+}
+
+
+/*
+ * Release all the memory allocated by te_open_address_space().
+ * Note: the images themselves are not released.
+ */
+void te_close_address_space(
+    te_address_space_t * const space)
+{
+    if (space)
+    {
+        for (size_t i = 0; i < space->num_contexts; i++)
+        {
+            free(space->contexts[i].mappings);
+        }
+        free(space->contexts);
+        free(space->all_contexts.mappings);
+        free(space);
+    }
+}
+
+
+/*
+ * Add (a copy of) "mapping" to the address space. This should not be
+ * called whilst any trace-decoder is fetching instructions from it.
+ *
+ * It returns zero on success, and non-zero if the mapping is empty,
+ * or it overlaps another mapping for the same context (or for all
+ * contexts, if it is for all contexts).
+ */
+int te_add_address_mapping(
+    te_address_space_t * const space,
+    const te_address_mapping_t * const mapping)
+{
+    te_context_map_t * map;
+
+    assert(space);
+    assert(mapping);
+    assert(mapping->get_instruction);
+
+    if ( (!mapping->size) ||
+         (mapping->first + (mapping->size - 1u) < mapping->first) )
+    {
+        return 1;   /* empty, or wraps around the address space */
+    }
+
+    if (mapping->all_contexts)
+    {
+        map = &space->all_contexts;
+    }
+    else
+    {
+        /* find the map for the context, creating it if it is new */
+        const size_t index = find_context_index(space, mapping->context);
+
+        if ( (index == space->num_contexts) ||
+             (space->contexts[index].context != mapping->context) )
+        {
+            space->contexts = realloc(space->contexts,
+                (space->num_contexts + 1u) * sizeof(te_context_map_t));
+            assert(space->contexts);
+            memmove(&space->contexts[index + 1u],
+                &space->contexts[index],
+                (space->num_contexts - index) * sizeof(te_context_map_t));
+            space->num_contexts++;
+
+            memset(&space->contexts[index], 0, sizeof(te_context_map_t));
+            space->contexts[index].context = mapping->context;
+        }
+
+        map = &space->contexts[index];
+    }
+
+    /* the mapping is inserted in front of the mapping at "index" */
+    const size_t index = find_mapping_index(map, mapping->first);
+
+    if ( (index) &&
+         (mapping->first - map->mappings[index - 1u].first < map->mappings[index - 1u].size) )
+    {
+        return 1;   /* overlaps the previous mapping */
+    }
+    if ( (index < map->num_mappings) &&
+         (map->mappings[index].first - mapping->first < mapping->size) )
+    {
+        return 1;   /* overlaps the next mapping */
+    }
+
+    map->mappings = realloc(map->mappings,
+        (map->num_mappings + 1u) * sizeof(te_address_mapping_t));
+    assert(map->mappings);
+    memmove(&map->mappings[index + 1u],
+        &map->mappings[index],
+        (map->num_mappings - index) * sizeof(te_address_mapping_t));
+    map->mappings[index] = *mapping;
+    map->num_mappings++;
+
+    return 0;   /* success */
+}
+
+
+/*
+ * Return the mapping containing "address" in "context", or NULL if none.
+ * Any mapping for the context itself is preferred, to one for all contexts.
+ */
+const te_address_mapping_t * te_find_address_mapping(
+    const te_address_space_t * const space,
+    const uint32_t context,
+    const te_address_t address)
+{
+    assert(space);
+
+    const size_t index = find_context_index(space, context);
+
+    if ( (index < space->num_contexts) &&
+         (space->contexts[index].context == context) )
+    {
+        const te_address_mapping_t * const mapping =
+            find_mapping(&space->contexts[index], address);
+        if (mapping)
+        {
+            return mapping;
+        }
+    }
+
+    return find_mapping(&space->all_contexts, address);
+}
+
+
+/*
+ * A te_get_context_instruction_t call-back, which may be assigned to
+ * decoder->get_context_instruction, with the address space as "user_data".
+ * Any address which is not in any mapping reads as an illegal (all zeros)
+ * 16-bit instruction.
+ *
+ * This may be called concurrently by any number of threads.
+ */
+unsigned te_get_address_space_instruction(
+    void * const user_data,
+    const uint32_t context,
+    const te_address_t address,
+    rv_inst * const instruction)
+{
+    const te_address_space_t * const space = (const te_address_space_t *)user_data;
+
+    assert(space);
+    assert(instruction);
+
+    const te_address_mapping_t * const mapping =
+        te_find_address_mapping(space, context, address);
+
+    if (mapping)
+    {
+        return (mapping->get_instruction)(
+            mapping->user_data,
+            address - mapping->first + mapping->image_address,
+            instruction);
+    }
+
+    *instruction = 0;   /* an illegal instruction */
+    return 2;
+}
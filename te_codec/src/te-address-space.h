@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2020 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef TE_ADDRESS_SPACE_H
+#define TE_ADDRESS_SPACE_H
+
+
+#include "decoder-algorithm-public.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/*
+ * An address space is a map from a (context, address) pair to the image
+ * containing the instruction at that address, for users tracing many
+ * address spaces, such as the kernel, shared libraries, and processes,
+ * with the context (e.g. an ASID) reported in te_inst synchronization
+ * packets identifying the address space in use.
+ *
+ * The map is a set of mappings, each of which maps a range of addresses
+ * onto an image, which is any te_get_instruction_t function (such as
+ * te_get_elf_instruction(), see te-elf-image.h), with its user_data, and
+ * the image address corresponding to the first address in the range.
+ * Each mapping is either for one context, or for all contexts (e.g. for
+ * the kernel). For each context, mappings are kept sorted by address in
+ * an interval index, which is searched with a binary-chop, before those
+ * for all contexts are searched.
+ *
+ * The function te_get_address_space_instruction() should be assigned to
+ * decoder->get_context_instruction, with the address space as user_data.
+ * The trace-decoder may set aside the decode caches of a few previous
+ * contexts (see TE_CONTEXT_CACHES), so changing back to one of those
+ * contexts does not flush them.
+ *
+ * Once all the mappings have been added, an address space may be shared
+ * by any number of trace-decoders, on any number of threads.
+ */
+typedef struct te_address_space_t te_address_space_t;
+
+typedef struct
+{
+    uint32_t context;           /* the context to which this mapping applies */
+    bool all_contexts;          /* if true, "context" is ignored */
+    te_address_t first;         /* first address in the range */
+    te_address_t size;          /* number of bytes in the range */
+    te_get_instruction_t * get_instruction;     /* image for the range */
+    void * user_data;           /* passed to get_instruction */
+    te_address_t image_address; /* image address corresponding to "first" */
+} te_address_mapping_t;
+
+
+/*
+ * The following are external functions DEFINED by this code.
+ * See the associated C source file for their semantics.
+ */
+extern te_address_space_t * te_open_address_space(void);
+
+extern void te_close_address_space(
+    te_address_space_t * const space);
+
+extern int te_add_address_mapping(
+    te_address_space_t * const space,
+    const te_address_mapping_t * const mapping);
+
+extern const te_address_mapping_t * te_find_address_mapping(
+    const te_address_space_t * const space,
+    const uint32_t context,
+    const te_address_t address);
+
+extern unsigned te_get_address_space_instruction(
+    void * const user_data,
+    const uint32_t context,
+    const te_address_t address,
+    rv_inst * const instruction);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif  /* TE_ADDRESS_SPACE_H */
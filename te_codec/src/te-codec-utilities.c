@@ -27,6 +27,7 @@
 
 
 #include <assert.h>
+#include <stdlib.h>
 #include "te-codec-utilities.h"
 
 
@@ -151,7 +152,71 @@ void te_initialize_bpred_table(
 
     memset(bpred->table,
         TE_BPRED_01,
-        sizeof(bpred->table));
+        bpred->size);
+}
+
+
+/*
+ * (re-)allocate the branch-predictor look-up table, to have the number
+ * of entries given by the discovery_response, and if it changes size,
+ * re-initialize all its elements. The table should be released by
+ * calling free(bpred->table).
+ */
+void te_size_bpred_table(
+    te_bpred_t * const bpred,
+    const te_discovery_response_t * const discovery_response)
+{
+    assert(bpred);
+    assert(discovery_response);
+
+    const size_t size = (size_t)1u << discovery_response->branch_prediction_size;
+
+    assert(size <= TE_BRANCH_PREDICTOR_SIZE);
+
+    if ( (bpred->table) && (size == bpred->size) )
+    {
+        return;     /* no change */
+    }
+
+    free(bpred->table);
+    bpred->table = malloc(size);
+    assert(bpred->table);
+    bpred->size = size;
+
+    te_initialize_bpred_table(bpred);
+}
+
+
+/*
+ * (re-)allocate the jump target cache "jump_target" of "*entries"
+ * entries, to have the number of entries given by the discovery_response,
+ * returning the (possibly new) jump target cache. If it changes size,
+ * all its entries are zeroed, and "*entries" is updated. The jump target
+ * cache should be released by calling free().
+ */
+te_address_t * te_size_jump_target_cache(
+    te_address_t * const jump_target,
+    size_t * const entries,
+    const te_discovery_response_t * const discovery_response)
+{
+    assert(entries);
+    assert(discovery_response);
+
+    const size_t size = (size_t)1u << discovery_response->jump_target_cache_size;
+
+    assert(size <= TE_JUMP_TARGET_CACHE_SIZE);
+
+    if ( (jump_target) && (size == *entries) )
+    {
+        return jump_target;     /* no change */
+    }
+
+    free(jump_target);
+    te_address_t * const resized = calloc(size, sizeof(te_address_t));
+    assert(resized);
+    *entries = size;
+
+    return resized;
 }
 
 
@@ -53,6 +53,15 @@ extern te_bpred_state_t te_next_bpred_state(
 extern void te_initialize_bpred_table(
     te_bpred_t * const bpred);
 
+extern void te_size_bpred_table(
+    te_bpred_t * const bpred,
+    const te_discovery_response_t * const discovery_response);
+
+extern te_address_t * te_size_jump_target_cache(
+    te_address_t * const jump_target,
+    size_t * const entries,
+    const te_discovery_response_t * const discovery_response);
+
 
 extern bool te_is_illegal_instruction(
     const te_inst_t * const te_inst);
@@ -28,9 +28,18 @@
 
 #include <assert.h>
 #include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if !defined(TE_ELF_DIS_WITHOUT_THREADS)
+#include <pthread.h>
+#endif  /* TE_ELF_DIS_WITHOUT_THREADS */
 
 #include "te-elf-dis.h"
 
@@ -43,11 +52,15 @@
  * Tuples may be added in any order. It is expected
  * that the array will be sorted by address order
  * once all the tuples have been inserted.
+ *
+ * Note: the line is not copied, "line" must point into
+ * the mapped elf-dis file.
  */
 static void add_one_elf_dis_tuple(
     te_elf_dis_file_t * const elf_dis,
     uint64_t const address,
-    const char * const line)
+    const char * const line,
+    const size_t length)
 {
     /* paranoia */
     assert(elf_dis);
@@ -56,8 +69,12 @@ static void add_one_elf_dis_tuple(
     /* first, do we need to grow the array of tuples ? */
     if (elf_dis->num_tuples == elf_dis->max_tuples)
     {
-        /* grow by 1024 tuples at a time (a power of 2) */
-        const size_t growth = 1u << 10;
+        /*
+         * double the number of tuples (at least 1024 at a time),
+         * so the total copying is linear in the number of tuples.
+         */
+        const size_t growth =
+            (elf_dis->max_tuples > (1u << 10)) ? elf_dis->max_tuples : (1u << 10);
         elf_dis->max_tuples += growth;
         membuf_append(
             &elf_dis->membuf,
@@ -70,9 +87,10 @@ static void add_one_elf_dis_tuple(
         (te_elf_dis_tuple_t*)(elf_dis->membuf.data)
         + elf_dis->num_tuples;
 
-    /* save both the fields to the first free tuple */
+    /* save all the fields to the first free tuple */
     tuple->address = address;
-    tuple->line = strdup_or_die(line);
+    tuple->line = line;
+    tuple->length = length;
 
     /* advance to the next tuple to use */
     elf_dis->num_tuples++;
@@ -107,77 +125,514 @@ static int compare_tuples(
 
 
 /*
- * This function is called to parse an entire
- * disassembly file, associated with the Elf
- * file, nominally generated by 'objdump -d'.
+ * true if "c" is white-space, as judged by isspace(3) in the "C" locale
+ */
+static bool is_white_space(
+    const char c)
+{
+    return (' ' == c) || ( ('\t' <= c) && (c <= '\r') );
+}
+
+
+/*
+ * Parse one line, from "line" up to (but excluding) "end", which is
+ * expected to be of the form:
  *
- * It returns zero on success, and non-zero otherwise.
+ *  <white-space> [<sign>] ["0x"] <hex-digits> ':' <white-space> <text>
+ *
+ * If it is, then this returns true, and sets "*address" from the
+ * <hex-digits>, and "*text" to the start of the (non-empty) <text>.
+ * Otherwise, this returns false.
+ *
+ * This accepts the same lines as the scanf(3) format
+ * "%" PRIx64 ":\t%[^\n]", which it replaces. So, the <sign> may be '+'
+ * or '-' (which negates the address, modulo 2^64), the "0x" prefix may
+ * also be "0X", and an address too large for 64 bits is UINT64_MAX.
  */
-int te_read_one_elf_dis_file(
-    te_elf_dis_file_t * const elf_dis,
+static bool parse_one_elf_dis_line(
+    const char * line,
+    const char * const end,
+    uint64_t * const address,
+    const char ** const text)
+{
+    uint64_t value = 0;
+    bool negative = false;
+    bool prefixed = false;
+    bool overflow = false;
+
+    assert(address);
+    assert(text);
+
+    /* skip any leading white-space */
+    while ( (line < end) && (is_white_space(*line)) )
+    {
+        line++;
+    }
+
+    /* skip any sign */
+    if ( (line < end) && (('+' == *line) || ('-' == *line)) )
+    {
+        negative = ('-' == *line);
+        line++;
+    }
+
+    /*
+     * skip any "0x" prefix, which (as for scanf) is itself
+     * taken as the address 0, if no hex-digits follow it
+     */
+    if ( (end - line >= 2) &&
+         ('0' == line[0]) &&
+         ('x' == (line[1] | 0x20)) )
+    {
+        line += 2;
+        prefixed = true;
+    }
+
+    /* accumulate the hex-digits (at least one, unless prefixed) */
+    const char * const digits = line;
+    for (; line < end; line++)
+    {
+        const unsigned decimal = (unsigned)(*line - '0');
+        const unsigned alpha = (unsigned)((*line | 0x20) - 'a');
+        unsigned digit;
+
+        if (decimal < 10u)
+        {
+            digit = decimal;
+        }
+        else if (alpha < 6u)
+        {
+            digit = alpha + 10u;
+        }
+        else
+        {
+            break;  /* end of the hex-digits */
+        }
+        overflow |= (value > (UINT64_MAX >> 4));
+        value = (value << 4) | digit;
+    }
+
+    if ( ( (line == digits) && (!prefixed) ) || (line == end) || (':' != *line) )
+    {
+        return false;   /* not an address, followed by a colon */
+    }
+
+    /* skip the colon, and any white-space following it */
+    line++;
+    while ( (line < end) && (is_white_space(*line)) )
+    {
+        line++;
+    }
+
+    if (line == end)
+    {
+        return false;   /* no text */
+    }
+
+    if (overflow)
+    {
+        value = UINT64_MAX;     /* as strtoull(3) */
+    }
+    else if (negative)
+    {
+        value = -value;
+    }
+
+    *address = value;
+    *text = line;
+
+    return true;
+}
+
+
+#if !defined(TE_ELF_DIS_WITHOUT_INDEX)
+/*
+ * The binary index, written alongside an elf-dis file (as the same
+ * name with TE_ELF_DIS_INDEX_SUFFIX appended) by te_write_elf_dis_index(),
+ * so that subsequent reads need neither parse nor sort the text again.
+ *
+ * The index is: this header, then "num_tuples" addresses (uint64_t,
+ * ascending), then "num_tuples + 1" offsets (uint64_t) into the
+ * string blob, then the string blob itself. The text of tuple "i"
+ * is from offsets[i] up to (but excluding) offsets[i+1].
+ *
+ * It is only used if it was written for the same elf-dis file,
+ * on a host with the same byte-order, as judged by the file's
+ * size, modification time, and hash_elf_dis_text().
+ */
+#if !defined(TE_ELF_DIS_INDEX_SUFFIX)
+#define TE_ELF_DIS_INDEX_SUFFIX     ".idx"
+#endif  /* TE_ELF_DIS_INDEX_SUFFIX */
+
+/*
+ * number of bytes at each end of the elf-dis file that are hashed.
+ * Hashing all of a large file would cost more than parsing it!
+ */
+#if !defined(TE_ELF_DIS_INDEX_HASH_BYTES)
+#define TE_ELF_DIS_INDEX_HASH_BYTES (64u * 1024u)
+#endif  /* TE_ELF_DIS_INDEX_HASH_BYTES */
+
+#define TE_ELF_DIS_INDEX_MAGIC      "TEDISIDX"
+#define TE_ELF_DIS_INDEX_VERSION    1u
+#define TE_ELF_DIS_INDEX_BYTE_ORDER 0x01020304u
+
+typedef struct
+{
+    char magic[8];              /* TE_ELF_DIS_INDEX_MAGIC */
+    uint32_t version;           /* TE_ELF_DIS_INDEX_VERSION */
+    uint32_t byte_order;        /* TE_ELF_DIS_INDEX_BYTE_ORDER */
+    uint64_t source_size;       /* size of the elf-dis file */
+    int64_t source_mtime_sec;   /* modification time of the elf-dis file */
+    int64_t source_mtime_nsec;
+    uint64_t source_hash;       /* from hash_elf_dis_text() */
+    uint64_t num_tuples;        /* number of addresses */
+    uint64_t blob_size;         /* number of bytes in the string blob */
+} te_elf_dis_index_header_t;
+
+
+/*
+ * return the 64-bit FNV-1a hash of the first and last
+ * TE_ELF_DIS_INDEX_HASH_BYTES of the "length" bytes at "text".
+ */
+static uint64_t hash_elf_dis_text(
+    const char * const text,
+    const size_t length)
+{
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);   /* offset basis */
+    const size_t head = (length < TE_ELF_DIS_INDEX_HASH_BYTES) ?
+        length : TE_ELF_DIS_INDEX_HASH_BYTES;
+    const size_t tail = (length - head < TE_ELF_DIS_INDEX_HASH_BYTES) ?
+        length - head : TE_ELF_DIS_INDEX_HASH_BYTES;
+
+    for (size_t i = 0; i < head; i++)
+    {
+        hash = (hash ^ (uint8_t)text[i]) * UINT64_C(0x100000001b3);
+    }
+    for (size_t i = length - tail; i < length; i++)
+    {
+        hash = (hash ^ (uint8_t)text[i]) * UINT64_C(0x100000001b3);
+    }
+
+    return hash;
+}
+
+
+/*
+ * initialize the index header, to describe the elf-dis file
+ * from which the tuples in "elf_dis" were read.
+ */
+static void init_elf_dis_index_header(
+    te_elf_dis_index_header_t * const header,
+    const te_elf_dis_file_t * const elf_dis)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, TE_ELF_DIS_INDEX_MAGIC, sizeof(header->magic));
+    header->version = TE_ELF_DIS_INDEX_VERSION;
+    header->byte_order = TE_ELF_DIS_INDEX_BYTE_ORDER;
+    header->source_size = elf_dis->source_size;
+    header->source_mtime_sec = elf_dis->source_mtime_sec;
+    header->source_mtime_nsec = elf_dis->source_mtime_nsec;
+    header->source_hash = elf_dis->source_hash;
+}
+
+
+/*
+ * return the name of the index of the elf-dis file "elf_dis_name",
+ * which should be released by calling free().
+ */
+static char * get_elf_dis_index_name(
     const char * const elf_dis_name)
 {
-    char buff[160], line[160];
-    uint64_t address;
+    char * const index_name =
+        malloc(strlen(elf_dis_name) + sizeof(TE_ELF_DIS_INDEX_SUFFIX));
+    assert(index_name);
 
-    assert(elf_dis);
-    assert(elf_dis_name);
+    strcpy(index_name, elf_dis_name);
+    strcat(index_name, TE_ELF_DIS_INDEX_SUFFIX);
 
-    /* open the disassembled Elf file */
-    FILE * const stream = fopen(elf_dis_name, "r");
+    return index_name;
+}
 
-    if (NULL == stream)     /* failed to open file ? */
+
+/*
+ * Try and populate the array of tuples from the index "index_name",
+ * given the expected header "expected" (with zero counts).
+ *
+ * On success, this returns true, and the tuples refer to the
+ * index, which is mapped with mmap(2) as "elf_dis->text".
+ * Otherwise (no index, or it is stale or malformed), this
+ * returns false, and there are still no tuples.
+ */
+static bool read_elf_dis_index(
+    te_elf_dis_file_t * const elf_dis,
+    const char * const index_name,
+    const te_elf_dis_index_header_t * const expected)
+{
+    struct stat status;
+    const te_elf_dis_index_header_t * header;
+
+    const int fd = open(index_name, O_RDONLY);
+
+    if (fd < 0)     /* no index ? */
     {
-        return 1;   /* failed ... nothing more to do here */
+        return false;
     }
 
-    /* initialize the data structures */
-    memset(elf_dis, 0, sizeof(*elf_dis));
-    membuf_init(&elf_dis->membuf);
+    if ( (fstat(fd, &status)) ||
+         ((size_t)status.st_size < sizeof(*header)) )
+    {
+        close(fd);
+        return false;
+    }
 
-    /* save the name of the Elf disassembly file */
-    elf_dis->elf_dis_name = strdup_or_die(elf_dis_name);
+    const size_t length = (size_t)status.st_size;
+    const char * const mapping =
+        mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
 
-    /* read each line in turn, extracting the required fields */
-    while (fgets(buff, sizeof(buff), stream))
+    if (MAP_FAILED == mapping)
     {
-        /*
-         * Input line expected to be of the form:
-         *
-         *  <hex-digits> ':' '<tab>' <text> '\n'
-         *
-         * Only two fields: the address (<hex-digits>), and the
-         * disassembler text (<text>) are required to be stored.
-         */
-        const int count =
-            sscanf(buff, "%" PRIx64 ":\t%[^\n]", &address, line);
+        return false;
+    }
+
+    /*
+     * check that the index describes the elf-dis file, and that the
+     * three arrays exactly fill it (taking care not to overflow).
+     */
+    header = (const te_elf_dis_index_header_t *)mapping;
+    const size_t num_tuples = (size_t)header->num_tuples;
+    const size_t available = length - sizeof(*header);
+
+    if ( (memcmp(header, expected,
+            offsetof(te_elf_dis_index_header_t, num_tuples))) ||
+         (num_tuples != header->num_tuples) ||
+         (num_tuples > available / (2u * sizeof(uint64_t))) ||
+         (available < (2u * num_tuples + 1u) * sizeof(uint64_t)) ||
+         (header->blob_size !=
+            available - (2u * num_tuples + 1u) * sizeof(uint64_t)) )
+    {
+        munmap((void*)mapping, length);
+        return false;
+    }
+
+    const uint64_t * const addresses = (const uint64_t *)(header + 1);
+    const uint64_t * const offsets = addresses + num_tuples;
+    const char * const blob = (const char *)(offsets + num_tuples + 1u);
+
+    /* build the array of tuples, checking each one as we go */
+    if (num_tuples)
+    {
+        membuf_append(
+            &elf_dis->membuf,
+            num_tuples * sizeof(te_elf_dis_tuple_t),
+            NULL);
+    }
+    te_elf_dis_tuple_t * const tuples =
+        (te_elf_dis_tuple_t *)(elf_dis->membuf.data);
+
+    bool valid = (0u == offsets[0]) &&
+        (header->blob_size == offsets[num_tuples]);
+    for (size_t i = 0; (valid) && (i < num_tuples); i++)
+    {
+        valid = (offsets[i] <= offsets[i + 1u]) &&
+            ( (0u == i) || (addresses[i - 1u] <= addresses[i]) );
+        tuples[i].address = addresses[i];
+        tuples[i].line = blob + offsets[i];
+        tuples[i].length = (size_t)(offsets[i + 1u] - offsets[i]);
+    }
+
+    if (!valid)
+    {
+        membuf_free(&elf_dis->membuf);
+        membuf_init(&elf_dis->membuf);
+        munmap((void*)mapping, length);
+        return false;
+    }
+
+    elf_dis->num_tuples = num_tuples;
+    elf_dis->max_tuples = num_tuples;
+    elf_dis->text = mapping;
+    elf_dis->text_length = length;
+
+    return true;
+}
+
+
+#endif  /* TE_ELF_DIS_WITHOUT_INDEX */
+
+
+/*
+ * If the (sorted) addresses are dense enough, that a direct look-up
+ * table, with one slot per possible instruction address, has no more
+ * than TE_ELF_DIS_DENSE_FACTOR slots per tuple, then that is used to
+ * find tuples. Otherwise, a copy of just the addresses is searched, in
+ * Eytzinger (breadth-first) order, which keeps the first few levels
+ * of the search in the same few cache lines, and lets each probe
+ * prefetch the cache line needed a few levels later.
+ */
+#if !defined(TE_ELF_DIS_DENSE_FACTOR)
+#define TE_ELF_DIS_DENSE_FACTOR     4u
+#endif  /* TE_ELF_DIS_DENSE_FACTOR */
+
+/* size of a cache line, in bytes (and the alignment of "keys") */
+#if !defined(TE_ELF_DIS_CACHE_LINE)
+#define TE_ELF_DIS_CACHE_LINE       64u
+#endif  /* TE_ELF_DIS_CACHE_LINE */
+
+
+/*
+ * Recursively fill "keys" and "ranks", from Eytzinger position "k"
+ * downwards, with the sorted "tuples", starting with tuple "i".
+ * It returns the index of the next tuple to be used.
+ */
+static size_t fill_elf_dis_keys(
+    te_elf_dis_file_t * const elf_dis,
+    const te_elf_dis_tuple_t * const tuples,
+    size_t i,
+    const size_t k)
+{
+    if (k <= elf_dis->num_tuples)
+    {
+        i = fill_elf_dis_keys(elf_dis, tuples, i, 2u * k);
+        elf_dis->keys[k] = tuples[i].address;
+        elf_dis->ranks[k] = i++;
+        i = fill_elf_dis_keys(elf_dis, tuples, i, 2u * k + 1u);
+    }
+
+    return i;
+}
+
+
+/*
+ * Build the structures used by te_find_one_elf_dis_tuple(),
+ * once the array of tuples is complete, and sorted.
+ */
+static void build_elf_dis_search(
+    te_elf_dis_file_t * const elf_dis)
+{
+    const te_elf_dis_tuple_t * const tuples =
+        (const te_elf_dis_tuple_t *)(elf_dis->membuf.data);
+    const size_t n = elf_dis->num_tuples;
+
+    if (!n)
+    {
+        return;     /* nothing to search */
+    }
+
+    /* is every address 2-byte aligned, relative to the first ? */
+    uint64_t offsets = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        offsets |= tuples[i].address - tuples[0].address;
+    }
+    const unsigned shift = (offsets & 1u) ? 0u : 1u;
+    const uint64_t span = (tuples[n - 1u].address - tuples[0].address) >> shift;
+
+    if ( (n < UINT32_MAX) &&
+         (span < (uint64_t)n * TE_ELF_DIS_DENSE_FACTOR) )
+    {
+        /* dense: a direct look-up table */
+        elf_dis->base = tuples[0].address;
+        elf_dis->shift = shift;
+        elf_dis->num_slots = (size_t)span + 1u;
+        elf_dis->slots = calloc(elf_dis->num_slots, sizeof(uint32_t));
+        assert(elf_dis->slots);
+
+        /* in reverse, so duplicated addresses use the first tuple */
+        for (size_t i = n; i--; )
+        {
+            const uint64_t slot = (tuples[i].address - elf_dis->base) >> shift;
+            elf_dis->slots[slot] = (uint32_t)(i + 1u);
+        }
+    }
+    else
+    {
+        /* sparse: in Eytzinger order, with "keys" cache-line aligned */
+        const size_t line = TE_ELF_DIS_CACHE_LINE;
+        const size_t size = ((n + 1u) * sizeof(uint64_t) + line - 1u) & ~(line - 1u);
+        elf_dis->keys = aligned_alloc(line, size);
+        assert(elf_dis->keys);
+        elf_dis->ranks = malloc((n + 1u) * sizeof(size_t));
+        assert(elf_dis->ranks);
+
+        elf_dis->keys[0] = 0;   /* unused */
+        elf_dis->ranks[0] = 0;
+        fill_elf_dis_keys(elf_dis, tuples, 0, 1u);
+    }
+}
+
+
+/*
+ * Parse the lines from "begin" up to (but excluding) "end", appending
+ * one tuple to "elf_dis" for each one that is disassembly, and then
+ * sort the tuples by address.
+ */
+static void parse_elf_dis_text(
+    te_elf_dis_file_t * const elf_dis,
+    const char * const begin,
+    const char * const end)
+{
+    uint64_t address;
+    const char * text;
+
+    /*
+     * first, count the lines (using memchr(3), which is typically
+     * vectorized), and allocate enough tuples for them all at once.
+     */
+    size_t max_lines = 0;
+    for (const char * p = begin; p < end; max_lines++)
+    {
+        const char * const newline = memchr(p, '\n', (size_t)(end - p));
+        p = (newline) ? (newline + 1) : end;
+    }
+    if (max_lines)
+    {
+        elf_dis->max_tuples = max_lines;
+        membuf_append(
+            &elf_dis->membuf,
+            max_lines * sizeof(te_elf_dis_tuple_t),
+            NULL);
+    }
+
+    /* then parse each line in turn, extracting the required fields */
+    bool sorted = true;
+    uint64_t previous = 0;
+    for (const char * line = begin; line < end; )
+    {
+        const char * newline = memchr(line, '\n', (size_t)(end - line));
+        if (NULL == newline)
+        {
+            newline = end;  /* final line has no newline */
+        }
 
         /*
          * if we get successfully retrieved both fields,
          * then append them both to the array of lines.
          * ... otherwise just silently discard the whole line.
          */
-        if (2 == count)
+        if (parse_one_elf_dis_line(line, newline, &address, &text))
         {
-            add_one_elf_dis_tuple(elf_dis, address, line);
+            add_one_elf_dis_tuple(elf_dis, address, text, (size_t)(newline - text));
+            sorted = sorted && (previous <= address);
+            previous = address;
         }
-    }
 
-    /* close the input stream */
-    fclose(stream);
+        line = (newline < end) ? (newline + 1) : end;
+    }
 
     /*
      * Finally, sort the array of tuples by address,
      * as it is not guaranteed that objdump will provide
      * everything in strictly ascending address order.
      *
-     * This array will be accessed using a binary-chop
-     * algorithm, hence it is essential that all
-     * the addresses are strictly increasing!
+     * This array will be searched by address (see
+     * build_elf_dis_search()), hence it is essential
+     * that all the addresses are in ascending order!
      *
-     * Assuming of course, there are at least two tuples!
+     * Assuming of course, there are at least two tuples,
+     * and they are not already in order (as is typical).
      */
-    if (elf_dis->num_tuples >= 2u)  /* worth sorting ? */
+    if ( (elf_dis->num_tuples >= 2u) && (!sorted) )   /* worth sorting ? */
     {
         qsort(
             elf_dis->membuf.data,
@@ -185,6 +640,408 @@ int te_read_one_elf_dis_file(
             sizeof(te_elf_dis_tuple_t),
             compare_tuples);
     }
+}
+
+
+#if !defined(TE_ELF_DIS_WITHOUT_THREADS)
+/*
+ * Large elf-dis files are split (at line boundaries) into chunks of
+ * at least TE_ELF_DIS_MIN_CHUNK bytes, which are parsed concurrently,
+ * by up to TE_ELF_DIS_MAX_THREADS threads (one per chunk, and no more
+ * than the number of on-line processors), and then merged.
+ */
+#if !defined(TE_ELF_DIS_MIN_CHUNK)
+#define TE_ELF_DIS_MIN_CHUNK        (8u * 1024u * 1024u)
+#endif  /* TE_ELF_DIS_MIN_CHUNK */
+
+#if !defined(TE_ELF_DIS_MAX_THREADS)
+#define TE_ELF_DIS_MAX_THREADS      16u
+#endif  /* TE_ELF_DIS_MAX_THREADS */
+
+/* one chunk of an elf-dis file, parsed by one thread */
+typedef struct
+{
+    const char * begin;         /* first character of the chunk */
+    const char * end;           /* one past its last character */
+    te_elf_dis_file_t elf_dis;  /* just its (sorted) tuples */
+    size_t next;                /* next tuple to be merged */
+    pthread_t thread;           /* the thread parsing it */
+    bool started;               /* was "thread" created ? */
+} te_elf_dis_chunk_t;
+
+
+/*
+ * return the number of chunks to split "length" bytes into.
+ */
+static size_t count_elf_dis_chunks(
+    const size_t length)
+{
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t num_chunks = length / TE_ELF_DIS_MIN_CHUNK;
+
+    if ( (cpus > 0) && (num_chunks > (size_t)cpus) )
+    {
+        num_chunks = (size_t)cpus;
+    }
+    if (num_chunks > TE_ELF_DIS_MAX_THREADS)
+    {
+        num_chunks = TE_ELF_DIS_MAX_THREADS;
+    }
+
+    return (num_chunks) ? num_chunks : 1u;
+}
+
+
+/*
+ * thread start routine, to parse one chunk.
+ */
+static void * parse_elf_dis_chunk(
+    void * const arg)
+{
+    te_elf_dis_chunk_t * const chunk = (te_elf_dis_chunk_t *)arg;
+
+    parse_elf_dis_text(&chunk->elf_dis, chunk->begin, chunk->end);
+
+    return NULL;
+}
+
+
+/*
+ * predicate: should the next tuple of chunk "x" be merged
+ * before that of chunk "y" ? Ties go to the earlier chunk,
+ * so equal addresses stay in the order of the file.
+ */
+static bool is_before_elf_dis_chunk(
+    const te_elf_dis_chunk_t * const chunks,
+    const size_t x,
+    const size_t y)
+{
+    const uint64_t x_address =
+        ((const te_elf_dis_tuple_t *)chunks[x].elf_dis.membuf.data)
+        [chunks[x].next].address;
+    const uint64_t y_address =
+        ((const te_elf_dis_tuple_t *)chunks[y].elf_dis.membuf.data)
+        [chunks[y].next].address;
+
+    return (x_address < y_address) ||
+        ( (x_address == y_address) && (x < y) );
+}
+
+
+/*
+ * restore the (binary min-)heap "heap" of "size" chunks,
+ * after the chunk at its root has changed.
+ */
+static void sift_down_elf_dis_chunks(
+    const te_elf_dis_chunk_t * const chunks,
+    size_t * const heap,
+    const size_t size)
+{
+    size_t parent = 0;
+
+    for (;;)
+    {
+        size_t least = parent;
+        const size_t left = 2u * parent + 1u;
+        const size_t right = left + 1u;
+
+        if ( (left < size) &&
+             (is_before_elf_dis_chunk(chunks, heap[left], heap[least])) )
+        {
+            least = left;
+        }
+        if ( (right < size) &&
+             (is_before_elf_dis_chunk(chunks, heap[right], heap[least])) )
+        {
+            least = right;
+        }
+        if (least == parent)
+        {
+            return;
+        }
+
+        const size_t swap = heap[parent];
+        heap[parent] = heap[least];
+        heap[least] = swap;
+        parent = least;
+    }
+}
+
+
+/*
+ * Merge the sorted tuples of all "num_chunks" chunks into "elf_dis".
+ *
+ * Typically, each chunk simply follows on from the previous one,
+ * and they are concatenated. Otherwise, they are merged with a
+ * k-way merge, using a heap of the chunks' next tuples.
+ */
+static void merge_elf_dis_chunks(
+    te_elf_dis_file_t * const elf_dis,
+    te_elf_dis_chunk_t * const chunks,
+    const size_t num_chunks)
+{
+    size_t num_tuples = 0;
+    bool in_order = true;
+    uint64_t previous = 0;
+
+    for (size_t i = 0; i < num_chunks; i++)
+    {
+        const te_elf_dis_tuple_t * const tuples =
+            (const te_elf_dis_tuple_t *)(chunks[i].elf_dis.membuf.data);
+        const size_t n = chunks[i].elf_dis.num_tuples;
+
+        if (n)
+        {
+            in_order = in_order && (previous <= tuples[0].address);
+            previous = tuples[n - 1u].address;
+            num_tuples += n;
+        }
+    }
+
+    if (!num_tuples)
+    {
+        return;     /* nothing to merge */
+    }
+
+    elf_dis->num_tuples = num_tuples;
+    elf_dis->max_tuples = num_tuples;
+    membuf_append(
+        &elf_dis->membuf,
+        num_tuples * sizeof(te_elf_dis_tuple_t),
+        NULL);
+    te_elf_dis_tuple_t * out = (te_elf_dis_tuple_t *)(elf_dis->membuf.data);
+
+    if (in_order)
+    {
+        for (size_t i = 0; i < num_chunks; i++)
+        {
+            const size_t n = chunks[i].elf_dis.num_tuples;
+
+            if (n)
+            {
+                memcpy(out, chunks[i].elf_dis.membuf.data,
+                    n * sizeof(te_elf_dis_tuple_t));
+                out += n;
+            }
+        }
+        return;
+    }
+
+    /* build the heap of non-empty chunks, then repeatedly take its root */
+    size_t * const heap = malloc(num_chunks * sizeof(size_t));
+    size_t size = 0;
+    assert(heap);
+
+    for (size_t i = 0; i < num_chunks; i++)
+    {
+        if (chunks[i].elf_dis.num_tuples)
+        {
+            /* sift "i" up, from the end of the heap */
+            size_t child = size++;
+            while ( (child) &&
+                    (is_before_elf_dis_chunk(chunks, i, heap[(child - 1u) / 2u])) )
+            {
+                heap[child] = heap[(child - 1u) / 2u];
+                child = (child - 1u) / 2u;
+            }
+            heap[child] = i;
+        }
+    }
+
+    while (size)
+    {
+        te_elf_dis_chunk_t * const chunk = &chunks[heap[0]];
+
+        *out++ = ((const te_elf_dis_tuple_t *)(chunk->elf_dis.membuf.data))
+            [chunk->next++];
+
+        if (chunk->next == chunk->elf_dis.num_tuples)
+        {
+            heap[0] = heap[--size];     /* this chunk is exhausted */
+        }
+        sift_down_elf_dis_chunks(chunks, heap, size);
+    }
+
+    free(heap);
+}
+
+
+/*
+ * Parse all the "length" bytes from "mapping" into "elf_dis", using
+ * "num_chunks" threads (including this one), each parsing one chunk.
+ * If a thread can not be created, this thread parses its chunk instead.
+ */
+static void parse_elf_dis_text_in_chunks(
+    te_elf_dis_file_t * const elf_dis,
+    const char * const mapping,
+    const size_t length,
+    const size_t num_chunks)
+{
+    const char * const end = mapping + length;
+    const char * begin = mapping;
+
+    te_elf_dis_chunk_t * const chunks =
+        calloc(num_chunks, sizeof(te_elf_dis_chunk_t));
+    assert(chunks);
+
+    /* split it into chunks of about equal size, at line boundaries */
+    for (size_t i = 0; i < num_chunks; i++)
+    {
+        const char * split = mapping + length / num_chunks * (i + 1u);
+
+        if (i + 1u == num_chunks)
+        {
+            split = end;    /* the last chunk takes the remainder */
+        }
+        else if (split < begin)
+        {
+            split = begin;  /* the previous chunk already includes it */
+        }
+        else
+        {
+            const char * const newline =
+                memchr(split, '\n', (size_t)(end - split));
+            split = (newline) ? (newline + 1) : end;
+        }
+
+        chunks[i].begin = begin;
+        chunks[i].end = split;
+        membuf_init(&chunks[i].elf_dis.membuf);
+        begin = split;
+    }
+
+    /* start the threads, and then join in with them */
+    for (size_t i = 1; i < num_chunks; i++)
+    {
+        chunks[i].started = (0 == pthread_create(
+            &chunks[i].thread, NULL, parse_elf_dis_chunk, &chunks[i]));
+    }
+    (void)parse_elf_dis_chunk(&chunks[0]);
+    for (size_t i = 1; i < num_chunks; i++)
+    {
+        if (chunks[i].started)
+        {
+            pthread_join(chunks[i].thread, NULL);
+        }
+        else
+        {
+            (void)parse_elf_dis_chunk(&chunks[i]);
+        }
+    }
+
+    merge_elf_dis_chunks(elf_dis, chunks, num_chunks);
+
+    for (size_t i = 0; i < num_chunks; i++)
+    {
+        membuf_free(&chunks[i].elf_dis.membuf);
+    }
+    free(chunks);
+}
+#endif  /* TE_ELF_DIS_WITHOUT_THREADS */
+
+
+/*
+ * This function is called to parse an entire
+ * disassembly file, associated with the Elf
+ * file, nominally generated by 'objdump -d'.
+ *
+ * The file is mapped into memory with mmap(2), and
+ * each tuple refers to its line in the mapping, so
+ * no memory is allocated for each line. The mapping
+ * is retained until te_free_one_elf_dis_file().
+ *
+ * Unless TE_ELF_DIS_WITHOUT_INDEX is defined, a valid
+ * binary index (see te_elf_dis_index_header_t) is used
+ * instead of parsing the file, if there is one. This never
+ * writes an index, see te_write_elf_dis_index().
+ *
+ * It returns zero on success, and non-zero otherwise.
+ */
+int te_read_one_elf_dis_file(
+    te_elf_dis_file_t * const elf_dis,
+    const char * const elf_dis_name)
+{
+    struct stat status;
+
+    assert(elf_dis);
+    assert(elf_dis_name);
+
+    /* open the disassembled Elf file */
+    const int fd = open(elf_dis_name, O_RDONLY);
+
+    if (fd < 0)     /* failed to open file ? */
+    {
+        return 1;   /* failed ... nothing more to do here */
+    }
+
+    if (fstat(fd, &status))
+    {
+        close(fd);
+        return 1;
+    }
+
+    /* map it (unless it is empty), the mapping outlives the descriptor */
+    const size_t length = (size_t)status.st_size;
+    const char * const mapping = (length) ?
+        mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0) :
+        NULL;
+    close(fd);
+
+    if (MAP_FAILED == mapping)
+    {
+        return 1;
+    }
+
+    /* initialize the data structures */
+    memset(elf_dis, 0, sizeof(*elf_dis));
+    membuf_init(&elf_dis->membuf);
+    elf_dis->text = mapping;
+    elf_dis->text_length = length;
+
+    /* save the name of the Elf disassembly file */
+    elf_dis->elf_dis_name = strdup_or_die(elf_dis_name);
+
+#if !defined(TE_ELF_DIS_WITHOUT_INDEX)
+    /* identify the file, and so the index that would describe it */
+    te_elf_dis_index_header_t header;
+    char * const index_name = get_elf_dis_index_name(elf_dis_name);
+    elf_dis->source_size = (uint64_t)status.st_size;
+    elf_dis->source_mtime_sec = (int64_t)status.st_mtim.tv_sec;
+    elf_dis->source_mtime_nsec = (int64_t)status.st_mtim.tv_nsec;
+    elf_dis->source_hash = hash_elf_dis_text(mapping, length);
+    init_elf_dis_index_header(&header, elf_dis);
+
+    /* if there is a valid index, then use it instead */
+    if ( (mapping) && (read_elf_dis_index(elf_dis, index_name, &header)) )
+    {
+        munmap((void*)mapping, length);
+        free(index_name);
+        build_elf_dis_search(elf_dis);
+        return 0;   /* success */
+    }
+    free(index_name);
+#endif  /* TE_ELF_DIS_WITHOUT_INDEX */
+
+    /* it will be read sequentially, once (apart from the lines retained) */
+    if (mapping)
+    {
+        (void)madvise((void *)mapping, length, MADV_SEQUENTIAL);
+    }
+
+#if !defined(TE_ELF_DIS_WITHOUT_THREADS)
+    /* parse it, in several chunks concurrently, if it is large enough */
+    const size_t num_chunks = count_elf_dis_chunks(length);
+    if (num_chunks > 1u)
+    {
+        parse_elf_dis_text_in_chunks(elf_dis, mapping, length, num_chunks);
+    }
+    else
+#endif  /* TE_ELF_DIS_WITHOUT_THREADS */
+    {
+        parse_elf_dis_text(elf_dis, mapping, mapping + length);
+    }
+
+    build_elf_dis_search(elf_dis);
 
     return 0;   /* success */
 }
@@ -197,31 +1054,129 @@ int te_read_one_elf_dis_file(
 void te_free_one_elf_dis_file(
     te_elf_dis_file_t * const elf_dis)
 {
-    /* pointer to the first tuple in the array */
-    te_elf_dis_tuple_t * tuple =
-        (te_elf_dis_tuple_t *)(elf_dis->membuf.data);
-
     /* free the elf-dis filename (if there was one) */
     if (elf_dis->elf_dis_name)
     {
         free((void*)elf_dis->elf_dis_name);
     }
 
-    /* free all the lines allocated with strdup_or_die() */
-    for (size_t i=0; i<elf_dis->num_tuples; i++,tuple++)
+    /* unmap the elf-dis file, to which all the lines refer */
+    if (elf_dis->text)
     {
-        free((void*)tuple->line);
+        munmap((void*)elf_dis->text, elf_dis->text_length);
     }
 
+    /* free the search structures */
+    free(elf_dis->keys);
+    free(elf_dis->ranks);
+    free(elf_dis->slots);
+
     /* finally, free the memory for the array of tuples */
     membuf_free(&elf_dis->membuf);
 }
 
 
+/*
+ * Write the (sorted) array of tuples in "elf_dis" to the binary index
+ * of its elf-dis file, so that subsequent calls of
+ * te_read_one_elf_dis_file() need not parse the file again. The index
+ * describes the elf-dis file as it was when it was read.
+ *
+ * The index is written to a uniquely named temporary file (created
+ * with mkstemp(3)), which is then renamed, so that concurrent readers
+ * (and writers) see either the old index, or a complete new one.
+ *
+ * It returns zero on success, and non-zero otherwise (including if
+ * TE_ELF_DIS_WITHOUT_INDEX is defined).
+ */
+int te_write_elf_dis_index(
+    const te_elf_dis_file_t * const elf_dis)
+{
+#if defined(TE_ELF_DIS_WITHOUT_INDEX)
+    (void)elf_dis;
+    return 1;   /* not supported */
+#else   /* TE_ELF_DIS_WITHOUT_INDEX */
+    te_elf_dis_index_header_t header;
+    uint64_t offset = 0;
+
+    assert(elf_dis);
+    assert(elf_dis->elf_dis_name);
+
+    const te_elf_dis_tuple_t * const tuples =
+        (const te_elf_dis_tuple_t *)(elf_dis->membuf.data);
+
+    init_elf_dis_index_header(&header, elf_dis);
+    header.num_tuples = elf_dis->num_tuples;
+    for (size_t i = 0; i < elf_dis->num_tuples; i++)
+    {
+        header.blob_size += tuples[i].length;
+    }
+
+    /* create a temporary file, alongside the index */
+    char * const index_name = get_elf_dis_index_name(elf_dis->elf_dis_name);
+    const char suffix[] = ".XXXXXX";
+    char * const temporary = malloc(strlen(index_name) + sizeof(suffix));
+    assert(temporary);
+    strcpy(temporary, index_name);
+    strcat(temporary, suffix);
+
+    const int fd = mkstemp(temporary);
+    FILE * const fp = (fd < 0) ? NULL : fdopen(fd, "wb");
+
+    if (NULL == fp)     /* failed to create file ? */
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+            (void)remove(temporary);
+        }
+        free(temporary);
+        free(index_name);
+        return 1;
+    }
+
+    /* mkstemp(3) creates it only readable by its owner */
+    bool ok = (0 == fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH));
+
+    ok = (ok) && (1u == fwrite(&header, sizeof(header), 1u, fp));
+    for (size_t i = 0; (ok) && (i < elf_dis->num_tuples); i++)
+    {
+        ok = (1u == fwrite(&tuples[i].address, sizeof(uint64_t), 1u, fp));
+    }
+    for (size_t i = 0; (ok) && (i < elf_dis->num_tuples); i++)
+    {
+        ok = (1u == fwrite(&offset, sizeof(offset), 1u, fp));
+        offset += tuples[i].length;
+    }
+    ok = (ok) && (1u == fwrite(&offset, sizeof(offset), 1u, fp));
+    for (size_t i = 0; (ok) && (i < elf_dis->num_tuples); i++)
+    {
+        ok = (tuples[i].length ==
+            fwrite(tuples[i].line, 1u, tuples[i].length, fp));
+    }
+
+    ok = (0 == fclose(fp)) && (ok);
+    ok = (ok) && (0 == rename(temporary, index_name));
+    if (!ok)
+    {
+        (void)remove(temporary);
+    }
+
+    free(temporary);
+    free(index_name);
+
+    return (ok) ? 0 : 1;
+#endif  /* TE_ELF_DIS_WITHOUT_INDEX */
+}
+
+
 /*
  * find the exact address 'address' in the array of
  * tuples ... if it exists, return the pointer to
  * the tuple ... otherwise return NULL.
+ *
+ * If there are several tuples with the same address,
+ * then the first of them is returned.
  */
 const te_elf_dis_tuple_t * te_find_one_elf_dis_tuple(
     const te_elf_dis_file_t * const elf_dis,
@@ -230,52 +1185,71 @@ const te_elf_dis_tuple_t * te_find_one_elf_dis_tuple(
     const te_elf_dis_tuple_t * const tuples =
         (te_elf_dis_tuple_t *)(elf_dis->membuf.data);
 
-    uint64_t lo = 0;                        /* lower bound */
-    uint64_t hi = elf_dis->num_tuples - 1u; /* upper bound */
+    /*
+     * if the addresses are dense, then simply index
+     * the look-up table, with no search at all.
+     */
+    if (elf_dis->slots)
+    {
+        const uint64_t offset = address - elf_dis->base;
+        const uint64_t slot = offset >> elf_dis->shift;
+
+        if ( (address < elf_dis->base) ||
+             (offset & ((1u << elf_dis->shift) - 1u)) ||
+             (slot >= elf_dis->num_slots) ||
+             (!elf_dis->slots[slot]) )
+        {
+            return NULL;    /* no match */
+        }
+
+        return tuples + elf_dis->slots[slot] - 1u;
+    }
 
     /*
      * if there are no tuples at all, then give up
      * now ... and simply return NULL.
      */
-    if (!elf_dis->num_tuples)
+    if (!elf_dis->keys)
     {
         return NULL;    /* no possible match */
     }
 
     /*
-     * check the address is strictly inside
-     * the valid range.
+     * descend the (implicit) Eytzinger tree, without branching on the
+     * comparisons, prefetching the cache line holding the descendants
+     * of "k" four levels down. "k" ends up as the position of the first
+     * key not less than "address", encoded as a path through the tree,
+     * followed by one 0 bit (a left turn), and then only 1 bits.
      */
-    if ( (address < tuples[lo].address) ||
-         (address > tuples[hi].address)   )
+    const uint64_t * const keys = elf_dis->keys;
+    const size_t n = elf_dis->num_tuples;
+    size_t k = 1;
+
+    while (k <= n)
     {
-        return NULL;    /* no possible match */
+#if defined(__GNUC__)
+        __builtin_prefetch(keys + 16u * k);
+#endif
+        k = 2u * k + (keys[k] < address);
     }
 
-    /*
-     * perform a binary-chop algorithm to find the address.
-     *
-     * Note: we assume all keys are strictly ascending!
-     */
-    while (lo <= hi)
+    /* remove the trailing 1 bits, and then the 0 bit */
+#if defined(__GNUC__)
+    k >>= __builtin_ctzll(~(unsigned long long)k) + 1;
+#else
+    while (k & 1u)
     {
-        uint64_t mid = (lo+hi) >> 1; /* mid-point */
+        k >>= 1;
+    }
+    k >>= 1;
+#endif
 
-        if (address == tuples[mid].address)
-        {
-            return tuples + mid;    /* got a match */
-        }
-        else if (address > tuples[mid].address)
-        {
-            lo = mid + 1;   /* use the upper half */
-        }
-        else
-        {
-            hi = mid - 1;   /* use the lower half */
-        }
+    if ( (!k) || (keys[k] != address) )
+    {
+        return NULL;        /* no match found */
     }
 
-    return NULL;        /* no match found */
+    return tuples + elf_dis->ranks[k];
 }
 
 
@@ -340,13 +1314,14 @@ void my_do_custom_instruction(
         if (tuple)  /* found a match ? */
         {
             /* use the disassembly line from the elf-dis file */
-            strncpy(
-                instr->line,
-                tuple->line,
-                sizeof(instr->line) - 1u);
+            const size_t length =
+                (tuple->length < sizeof(instr->line)) ?
+                    tuple->length :
+                    sizeof(instr->line) - 1u;
+            memcpy(instr->line, tuple->line, length);
 
             /* ensure it is always nul-terminated */
-            instr->line[sizeof(instr->line) - 1u] = '\0';
+            instr->line[length] = '\0';
 
             /*
              * update the "instr" structure to record
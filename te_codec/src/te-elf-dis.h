@@ -47,11 +47,16 @@
 #endif  /* TE_INCLUDE_TE_MEMORY_H */
 
 
-/* one 2-tuple (pair of fields) per disassembled line */
+/*
+ * one tuple per disassembled line.
+ * Note: "line" points into the mapped elf-dis file (or its index),
+ * and is NOT nul-terminated, instead it is "length" characters long.
+ */
 typedef struct
 {
     uint64_t address;   /* disassembly address (the key) */
     const char * line;  /* disassembly line (the text) */
+    size_t length;      /* number of characters in "line" */
 } te_elf_dis_tuple_t;
 
 
@@ -62,6 +67,20 @@ typedef struct
     size_t num_tuples;      /* number currently used */
     size_t max_tuples;      /* number currently allocated */
     membuf_t membuf;        /* array of te_elf_dis_tuple_t */
+    const char * text;      /* the elf-dis file (or index), from mmap(2) */
+    size_t text_length;     /* number of bytes mapped */
+    /* the elf-dis file, when it was read (to validate its index) */
+    uint64_t source_size;       /* its size, in bytes */
+    int64_t source_mtime_sec;   /* its modification time */
+    int64_t source_mtime_nsec;
+    uint64_t source_hash;       /* hash of (some of) its text */
+    /* search structures, built by te_read_one_elf_dis_file() */
+    uint64_t * keys;        /* addresses, in Eytzinger order (from 1) */
+    size_t * ranks;         /* index of the tuple for each of "keys" */
+    uint32_t * slots;       /* if dense, 1 + index of tuple, or 0 */
+    size_t num_slots;       /* number of "slots" */
+    uint64_t base;          /* address of "slots[0]" */
+    unsigned shift;         /* log2 of the address step between slots */
 } te_elf_dis_file_t;
 
 
@@ -69,6 +88,9 @@ extern int te_read_one_elf_dis_file(
     te_elf_dis_file_t * const elf_dis,
     const char * const elf_dis_name);
 
+extern int te_write_elf_dis_index(
+    const te_elf_dis_file_t * const elf_dis);
+
 extern void te_free_one_elf_dis_file(
     te_elf_dis_file_t * const elf_dis);
 
@@ -0,0 +1,543 @@
+/*
+ * Copyright (c) 2020 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "te-elf-image.h"
+
+
+/*
+ * One loadable segment, with its contents in a mapped ELF file.
+ * Addresses from "first" up to (but excluding) "end" are present.
+ */
+typedef struct
+{
+    te_address_t first;
+    te_address_t end;
+    const uint8_t * bytes;      /* contents at address "first" */
+} te_elf_segment_t;
+
+
+/*
+ * One mapped ELF file.
+ */
+typedef struct
+{
+    void * base;
+    size_t length;
+} te_elf_mapping_t;
+
+
+struct te_elf_image_t
+{
+    /* all the segments, sorted by their "first" address */
+    te_elf_segment_t * segments;    /* [num_segments] */
+    size_t num_segments;
+
+    /* all the ELF files mapped */
+    te_elf_mapping_t * mappings;    /* [num_mappings] */
+    size_t num_mappings;
+
+    /* index of the segment which satisfied the most recent fetch */
+    atomic_size_t last_hit;
+
+    /* call-back for addresses not in any segment (may be NULL) */
+    te_get_instruction_t * fallback;
+    void * fallback_user_data;
+};
+
+
+/*
+ * comparison function used by qsort(3)
+ */
+static int compare_segments(
+    const void * const segment_1,
+    const void * const segment_2)
+{
+    const te_elf_segment_t * const x =
+        (const te_elf_segment_t*)segment_1;
+    const te_elf_segment_t * const y =
+        (const te_elf_segment_t*)segment_2;
+
+    if (x->first == y->first)
+    {
+        return 0;   /* segment_1 == segment_2 */
+    }
+    else if (x->first > y->first)
+    {
+        return 1;   /* segment_1 > segment_2 */
+    }
+    else
+    {
+        return -1;  /* segment_1 < segment_2 */
+    }
+}
+
+
+/*
+ * Append one segment to the (unsorted) table of segments.
+ */
+static void add_one_elf_segment(
+    te_elf_image_t * const image,
+    const te_address_t first,
+    const uint64_t size,
+    const uint8_t * const bytes)
+{
+    assert(image);
+    assert(bytes);
+
+    image->segments = realloc(image->segments,
+        (image->num_segments + 1u) * sizeof(te_elf_segment_t));
+    assert(image->segments);
+
+    te_elf_segment_t * const segment = &image->segments[image->num_segments++];
+    segment->first = first;
+    segment->end = first + size;
+    segment->bytes = bytes;
+}
+
+
+/*
+ * Define a function to add all the loadable segments (with some contents
+ * in the file) of a mapped ELF file of "length" bytes at "base", to the
+ * table of segments, for either 32-bit or 64-bit ELF files.
+ *
+ * It returns zero on success, and non-zero if the file is malformed.
+ */
+#define TE_DEFINE_ADD_ELF_SEGMENTS(bits)                                    \
+static int add_elf##bits##_segments(                                        \
+    te_elf_image_t * const image,                                           \
+    const uint8_t * const base,                                             \
+    const size_t length)                                                    \
+{                                                                           \
+    const Elf##bits##_Ehdr * const ehdr = (const Elf##bits##_Ehdr *)base;   \
+                                                                            \
+    if ( (length < sizeof(Elf##bits##_Ehdr))                        ||      \
+         (ehdr->e_phentsize != sizeof(Elf##bits##_Phdr))            ||      \
+         (ehdr->e_phoff > length)                                   ||      \
+         (ehdr->e_phnum >                                                   \
+            (length - ehdr->e_phoff) / sizeof(Elf##bits##_Phdr)) )          \
+    {                                                                       \
+        return 1;   /* malformed program headers */                         \
+    }                                                                       \
+                                                                            \
+    const Elf##bits##_Phdr * const phdrs =                                  \
+        (const Elf##bits##_Phdr *)(base + ehdr->e_phoff);                   \
+                                                                            \
+    for (size_t i = 0; i < ehdr->e_phnum; i++)                              \
+    {                                                                       \
+        const Elf##bits##_Phdr * const phdr = &phdrs[i];                    \
+                                                                            \
+        if ( (PT_LOAD != phdr->p_type) || (!phdr->p_filesz) )               \
+        {                                                                   \
+            continue;   /* nothing to fetch from this segment */            \
+        }                                                                   \
+        if ( (phdr->p_offset > length) ||                                   \
+             (phdr->p_filesz > length - phdr->p_offset) )                   \
+        {                                                                   \
+            return 1;   /* segment is not wholly inside the file */         \
+        }                                                                   \
+        if ((te_address_t)phdr->p_vaddr + phdr->p_filesz < phdr->p_vaddr)   \
+        {                                                                   \
+            return 1;   /* segment wraps beyond the top of memory */        \
+        }                                                                   \
+        add_one_elf_segment(                                                \
+            image,                                                          \
+            phdr->p_vaddr,                                                  \
+            phdr->p_filesz,                                                 \
+            base + phdr->p_offset);                                         \
+    }                                                                       \
+                                                                            \
+    return 0;   /* success */                                               \
+}
+
+TE_DEFINE_ADD_ELF_SEGMENTS(32)
+TE_DEFINE_ADD_ELF_SEGMENTS(64)
+
+
+/*
+ * Add all the loadable segments of a mapped ELF file
+ * of "length" bytes at "base", to the table of segments.
+ *
+ * It returns zero on success, and non-zero otherwise.
+ */
+static int add_elf_segments(
+    te_elf_image_t * const image,
+    const void * const base,
+    const size_t length)
+{
+    assert(image);
+    assert(base);
+
+    const unsigned char * const ident = (const unsigned char *)base;
+
+    if ( (length < EI_NIDENT)                           ||
+         (0 != memcmp(ident, ELFMAG, SELFMAG))          ||
+         (ELFDATA2LSB != ident[EI_DATA]) )
+    {
+        return 1;   /* not a little-endian ELF file */
+    }
+
+    switch (ident[EI_CLASS])
+    {
+        case ELFCLASS32:
+            return add_elf32_segments(image, base, length);
+
+        case ELFCLASS64:
+            return add_elf64_segments(image, base, length);
+
+        default:
+            return 1;   /* unknown ELF class */
+    }
+}
+
+
+/*
+ * Sort the table of segments by address, as the binary-chop requires.
+ * It returns zero on success, or non-zero if any two segments overlap.
+ */
+static int sort_elf_segments(
+    te_elf_image_t * const image)
+{
+    assert(image);
+
+    if (image->num_segments < 2u)   /* not worth sorting ? */
+    {
+        return 0;
+    }
+
+    qsort(
+        image->segments,
+        image->num_segments,
+        sizeof(te_elf_segment_t),
+        compare_segments);
+
+    for (size_t i = 1; i < image->num_segments; i++)
+    {
+        if (image->segments[i].first < image->segments[i - 1u].end)
+        {
+            return 1;   /* overlaps the previous segment */
+        }
+    }
+
+    return 0;   /* success */
+}
+
+
+/*
+ * Remove all the segments whose contents are in the "length" bytes
+ * at "base" (i.e. those of one mapped ELF file) from the table of
+ * segments, keeping the rest in the same order.
+ */
+static void remove_elf_segments(
+    te_elf_image_t * const image,
+    const void * const base,
+    const size_t length)
+{
+    assert(image);
+
+    const uint8_t * const first = (const uint8_t *)base;
+    size_t kept = 0;
+
+    for (size_t i = 0; i < image->num_segments; i++)
+    {
+        const uint8_t * const bytes = image->segments[i].bytes;
+        if ( (bytes < first) || (bytes >= first + length) )
+        {
+            image->segments[kept++] = image->segments[i];
+        }
+    }
+
+    image->num_segments = kept;
+}
+
+
+/*
+ * Return the segment containing the "bytes" bytes from "address"
+ * onwards, or NULL if there is no such segment.
+ *
+ * The segment which satisfied the previous fetch is tried first,
+ * as the next fetch is very likely to be in the same segment.
+ */
+static const te_elf_segment_t * find_elf_segment(
+    te_elf_image_t * const image,
+    const te_address_t address,
+    const unsigned bytes)
+{
+    assert(image);
+
+    const te_elf_segment_t * const segments = image->segments;
+    const size_t last_hit =
+        atomic_load_explicit(&image->last_hit, memory_order_relaxed);
+
+    /* fast path: is it in the same segment as last time ? */
+    if ( (last_hit < image->num_segments)                   &&
+         (address >= segments[last_hit].first)              &&
+         (address + bytes <= segments[last_hit].end) )
+    {
+        return &segments[last_hit];
+    }
+
+    /*
+     * perform a binary-chop to find the last segment whose
+     * first address is not beyond "address", if any.
+     */
+    size_t lo = 0;
+    size_t hi = image->num_segments;
+
+    while (lo < hi)
+    {
+        const size_t mid = lo + ((hi - lo) >> 1);
+
+        if (segments[mid].first <= address)
+        {
+            lo = mid + 1u;  /* use the upper half */
+        }
+        else
+        {
+            hi = mid;       /* use the lower half */
+        }
+    }
+
+    if ( (lo)   &&
+         (address + bytes <= segments[lo - 1u].end) )
+    {
+        atomic_store_explicit(&image->last_hit, lo - 1u, memory_order_relaxed);
+        return &segments[lo - 1u];
+    }
+
+    return NULL;    /* not in any segment */
+}
+
+
+/*
+ * Read the 16-bit parcel at "address" into "*parcel".
+ * It returns true on success, or false if it is not in any segment.
+ */
+static bool read_elf_parcel(
+    te_elf_image_t * const image,
+    const te_address_t address,
+    uint16_t * const parcel)
+{
+    assert(parcel);
+
+    const te_elf_segment_t * const segment =
+        find_elf_segment(image, address, sizeof(uint16_t));
+
+    if (!segment)
+    {
+        return false;
+    }
+
+    /* little-endian, irrespective of the host */
+    const uint8_t * const bytes = segment->bytes + (address - segment->first);
+    *parcel = (uint16_t)(bytes[0] | (bytes[1] << 8));
+
+    return true;
+}
+
+
+/*
+ * Create a new (empty) ELF image. Addresses which are not in any
+ * ELF file added will be passed on to "fallback" (with the user-data
+ * "fallback_user_data"), unless "fallback" is NULL. The image should
+ * be released with te_close_elf_image(), once no trace-decoders are
+ * using it.
+ */
+te_elf_image_t * te_open_elf_image(
+    te_get_instruction_t * const fallback,
+    void * const fallback_user_data)
+{
+    te_elf_image_t * const image = calloc(1, sizeof(te_elf_image_t));
+    assert(image);
+
+    atomic_init(&image->last_hit, 0);
+    image->fallback = fallback;
+    image->fallback_user_data = fallback_user_data;
+
+    return image;
+}
+
+
+/*
+ * Map the ELF file "elf_name" into memory, and add all its loadable
+ * segments to the image. The file stays mapped until the image is
+ * closed. This should not be called whilst any trace-decoder is
+ * fetching instructions from the image.
+ *
+ * It returns zero on success, and non-zero otherwise, including if any
+ * of its segments overlap each other, or any segment already added (in
+ * which case, none of its segments are added).
+ */
+int te_add_elf_image_file(
+    te_elf_image_t * const image,
+    const char * const elf_name)
+{
+    struct stat status;
+
+    assert(image);
+    assert(elf_name);
+
+    /* open the ELF file */
+    const int fd = open(elf_name, O_RDONLY);
+
+    if (fd < 0)     /* failed to open file ? */
+    {
+        return 1;   /* failed ... nothing more to do here */
+    }
+
+    if ( (fstat(fd, &status)) || (status.st_size <= 0) )
+    {
+        close(fd);
+        return 1;
+    }
+
+    const size_t length = (size_t)status.st_size;
+    void * const base = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    /* the mapping stays valid once the file is closed */
+    close(fd);
+
+    if (MAP_FAILED == base)
+    {
+        return 1;
+    }
+
+    const size_t num_segments = image->num_segments;
+
+    if (add_elf_segments(image, base, length))
+    {
+        /* malformed ... discard any of its segments already added */
+        image->num_segments = num_segments;
+        munmap(base, length);
+        return 1;
+    }
+
+    if (sort_elf_segments(image))
+    {
+        /* overlapping ... discard all of its segments (still sorted) */
+        remove_elf_segments(image, base, length);
+        munmap(base, length);
+        return 1;
+    }
+    atomic_store_explicit(&image->last_hit, 0, memory_order_relaxed);
+
+    /* remember the mapping, so it can be unmapped on close */
+    image->mappings = realloc(image->mappings,
+        (image->num_mappings + 1u) * sizeof(te_elf_mapping_t));
+    assert(image->mappings);
+    image->mappings[image->num_mappings].base = base;
+    image->mappings[image->num_mappings].length = length;
+    image->num_mappings++;
+
+    return 0;   /* success */
+}
+
+
+/*
+ * Release all the memory allocated by te_open_elf_image(), and
+ * unmap all the ELF files added to the image.
+ */
+void te_close_elf_image(
+    te_elf_image_t * const image)
+{
+    if (image)
+    {
+        for (size_t i = 0; i < image->num_mappings; i++)
+        {
+            munmap(image->mappings[i].base, image->mappings[i].length);
+        }
+        free(image->mappings);
+        free(image->segments);
+        free(image);
+    }
+}
+
+
+/*
+ * Read the raw instruction at "address" from the image into
+ * "*instruction", returning its length (2 or 4 bytes).
+ *
+ * This may be called concurrently by any number of threads.
+ */
+unsigned te_read_elf_image(
+    te_elf_image_t * const image,
+    const te_address_t address,
+    rv_inst * const instruction)
+{
+    uint16_t low, high;
+
+    assert(image);
+    assert(instruction);
+
+    if (read_elf_parcel(image, address, &low))
+    {
+        if (3u != (low & 3u))
+        {
+            *instruction = low;     /* a 16-bit instruction */
+            return 2;
+        }
+        if (read_elf_parcel(image, address + 2u, &high))
+        {
+            *instruction = low | ((rv_inst)high << 16);
+            return 4;
+        }
+    }
+
+    /* not (wholly) in any segment */
+    if (image->fallback)
+    {
+        return (image->fallback)(image->fallback_user_data, address, instruction);
+    }
+
+    *instruction = 0;   /* an illegal instruction */
+    return 2;
+}
+
+
+/*
+ * A te_get_instruction_t call-back, which may be passed directly to
+ * te_open_trace_decoder(), with the ELF image as its "user_data".
+ * Users needing their own user_data should call te_read_elf_image()
+ * from their own get_instruction call-back instead.
+ */
+unsigned te_get_elf_instruction(
+    void * const user_data,
+    const te_address_t address,
+    rv_inst * const instruction)
+{
+    return te_read_elf_image((te_elf_image_t *)user_data, address, instruction);
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2020 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+#ifndef TE_ELF_IMAGE_H
+#define TE_ELF_IMAGE_H
+
+
+#include "decoder-algorithm-public.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/*
+ * An ELF image is a ready-made provider of raw instructions, which
+ * may be used as the trace-decoder's get_instruction call-back.
+ *
+ * One or more (little-endian, 32-bit or 64-bit) ELF files are added to
+ * the image, each of which is mapped into memory with mmap(2), and the
+ * contents of each of their loadable (PT_LOAD) segments is then read
+ * directly from the mapping, without copying. The segments are kept in
+ * a table sorted by address, which is searched with a binary-chop,
+ * after first checking the segment which satisfied the previous fetch.
+ *
+ * Any address which is not in any loadable segment is passed on to
+ * the "fallback" function (if any), otherwise it reads as an illegal
+ * (all zeros) 16-bit instruction.
+ *
+ * Once all the ELF files have been added, an image may be shared by
+ * any number of trace-decoders, on any number of threads.
+ */
+typedef struct te_elf_image_t te_elf_image_t;
+
+
+/*
+ * The following are external functions DEFINED by this code.
+ * See the associated C source file for their semantics.
+ */
+extern te_elf_image_t * te_open_elf_image(
+    te_get_instruction_t * const fallback,
+    void * const fallback_user_data);
+
+extern int te_add_elf_image_file(
+    te_elf_image_t * const image,
+    const char * const elf_name);
+
+extern void te_close_elf_image(
+    te_elf_image_t * const image);
+
+extern unsigned te_read_elf_image(
+    te_elf_image_t * const image,
+    const te_address_t address,
+    rv_inst * const instruction);
+
+extern unsigned te_get_elf_instruction(
+    void * const user_data,
+    const te_address_t address,
+    rv_inst * const instruction);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif  /* TE_ELF_IMAGE_H */
@@ -0,0 +1,388 @@
+/*
+ * Copyright (c) 2020 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+/*
+ * A reference implementation of the functions declared in "te-memory.h".
+ */
+
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "te-memory.h"
+
+
+/*
+ * minimum number of bytes allocated for a (non-reserved) membuf_t.
+ * Thereafter, its capacity is doubled each time it needs to grow.
+ */
+#if !defined(TE_MEMBUF_MIN_CAPACITY)
+#define TE_MEMBUF_MIN_CAPACITY  256u
+#endif  /* TE_MEMBUF_MIN_CAPACITY */
+
+/*
+ * granularity (and alignment) of reserved membuf_t memory, which is
+ * committed in these steps. Typically, the size of a huge page.
+ */
+#if !defined(TE_MEMBUF_COMMIT_SIZE)
+#define TE_MEMBUF_COMMIT_SIZE   (2u * 1024u * 1024u)
+#endif  /* TE_MEMBUF_COMMIT_SIZE */
+
+/* default size of each block in an arena_t */
+#if !defined(TE_ARENA_BLOCK_SIZE)
+#define TE_ARENA_BLOCK_SIZE     (64u * 1024u)
+#endif  /* TE_ARENA_BLOCK_SIZE */
+
+
+/* one block of memory in an arena_t */
+struct arena_block_t
+{
+    struct arena_block_t * next;    /* the previous block */
+    alignas(max_align_t) char bytes[];
+};
+
+
+/*
+ * report a failure to allocate memory, and exit.
+ */
+static void out_of_memory(
+    const size_t size)
+{
+    fprintf(stderr, "ERROR: unable to allocate %zu bytes of memory\n", size);
+    exit(EXIT_FAILURE);
+}
+
+
+/*
+ * round "size" up to the next multiple of "alignment" (a power of 2),
+ * exiting if that is not representable.
+ */
+static size_t round_up(
+    const size_t size,
+    const size_t alignment)
+{
+    assert(0u == (alignment & (alignment - 1u)));
+
+    if (size > SIZE_MAX - (alignment - 1u))
+    {
+        out_of_memory(size);
+    }
+
+    return (size + alignment - 1u) & ~(alignment - 1u);
+}
+
+
+/*
+ * initialize an empty membuf_t
+ */
+void membuf_init(
+    membuf_t * const buf)
+{
+    assert(buf);
+
+    memset(buf, 0, sizeof(*buf));
+}
+
+
+/*
+ * Reserve (but do not yet commit) "size" bytes of address space
+ * for the (empty) membuf_t "buf", so that it never moves, and
+ * can never grow beyond "size" bytes. Transparent huge pages are
+ * requested for it, where supported. If "size" is zero, nothing
+ * is reserved, and the buffer grows with realloc(3) as usual.
+ */
+void membuf_reserve(
+    membuf_t * const buf,
+    const size_t size)
+{
+    assert(buf);
+    assert(!buf->data);     /* must be empty */
+
+    if (0 == size)
+    {
+        return;     /* nothing to do */
+    }
+
+    /* over-reserve, so that it can be aligned to a huge page */
+    const size_t reserved = round_up(size, TE_MEMBUF_COMMIT_SIZE);
+    if (reserved > SIZE_MAX - TE_MEMBUF_COMMIT_SIZE)
+    {
+        out_of_memory(size);
+    }
+    const size_t padded = reserved + TE_MEMBUF_COMMIT_SIZE;
+    char * const mapping = mmap(NULL, padded, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (MAP_FAILED == mapping)
+    {
+        out_of_memory(size);
+    }
+
+    /* release the unaligned head and tail */
+    char * const aligned = (char *)round_up((size_t)mapping, TE_MEMBUF_COMMIT_SIZE);
+    const size_t head = (size_t)(aligned - mapping);
+    if (head)
+    {
+        munmap(mapping, head);
+    }
+    munmap(aligned + reserved, padded - head - reserved);
+
+#if defined(MADV_HUGEPAGE)
+    (void)madvise(aligned, reserved, MADV_HUGEPAGE);
+#endif  /* MADV_HUGEPAGE */
+
+    buf->data = aligned;
+    buf->reserved = reserved;
+}
+
+
+/*
+ * Append "length" bytes to the membuf_t "buf", copied from "data",
+ * or zeroed if "data" is NULL. It returns the offset of the appended
+ * bytes within buf->data. It exits if there is not enough memory.
+ */
+size_t membuf_append(
+    membuf_t * const buf,
+    const size_t length,
+    const void * const data)
+{
+    assert(buf);
+
+    const size_t offset = buf->length;
+
+    if (length > SIZE_MAX - offset)
+    {
+        out_of_memory(length);
+    }
+
+    const size_t needed = offset + length;
+
+    if (needed > buf->capacity)     /* need to grow ? */
+    {
+        if (buf->reserved)
+        {
+            /* commit more of the reservation (already zeroed) */
+            const size_t capacity = round_up(needed, TE_MEMBUF_COMMIT_SIZE);
+            if ( (capacity > buf->reserved) ||
+                 (mprotect((char *)buf->data + buf->capacity,
+                    capacity - buf->capacity, PROT_READ | PROT_WRITE)) )
+            {
+                out_of_memory(needed);
+            }
+            buf->capacity = capacity;
+        }
+        else
+        {
+            /* grow geometrically, to amortize the copying */
+            size_t capacity = (buf->capacity) ?
+                buf->capacity : TE_MEMBUF_MIN_CAPACITY;
+            while (capacity < needed)
+            {
+                capacity = (capacity <= SIZE_MAX / 2u) ? 2u * capacity : needed;
+            }
+            void * const grown = realloc(buf->data, capacity);
+            if (NULL == grown)
+            {
+                out_of_memory(capacity);
+            }
+            buf->data = grown;
+            buf->capacity = capacity;
+        }
+    }
+
+    if (data)
+    {
+        memcpy((char *)buf->data + offset, data, length);
+    }
+    else if (!buf->reserved)
+    {
+        memset((char *)buf->data + offset, 0, length);
+    }
+    buf->length = needed;
+
+    return offset;
+}
+
+
+/*
+ * free all the memory managed by the membuf_t "buf",
+ * leaving it empty (and not reserved).
+ */
+void membuf_free(
+    membuf_t * const buf)
+{
+    assert(buf);
+
+    if (buf->reserved)
+    {
+        munmap(buf->data, buf->reserved);
+    }
+    else
+    {
+        free(buf->data);
+    }
+
+    membuf_init(buf);
+}
+
+
+/*
+ * wrapper for strdup() ... but exit() if it fails
+ */
+char * strdup_or_die(
+    const char * const str)
+{
+    assert(str);
+
+    const size_t size = strlen(str) + 1u;
+    char * const copy = malloc(size);
+
+    if (NULL == copy)
+    {
+        out_of_memory(size);
+    }
+
+    return memcpy(copy, str, size);
+}
+
+
+/*
+ * initialize an empty arena_t
+ */
+void arena_init(
+    arena_t * const arena)
+{
+    assert(arena);
+
+    memset(arena, 0, sizeof(*arena));
+}
+
+
+/*
+ * Allocate "size" bytes, aligned to "alignment" (a power of 2, no more
+ * than that of max_align_t), by bumping the next free byte of the
+ * arena_t "arena", first starting a new block, if there is not enough
+ * room in the current one. It exits if there is not enough memory.
+ */
+static void * arena_bump(
+    arena_t * const arena,
+    const size_t size,
+    const size_t alignment)
+{
+    assert(arena);
+    assert(0u == (alignment & (alignment - 1u)));
+    assert(alignment <= alignof(max_align_t));
+
+    /* number of bytes to skip, to align the next free byte */
+    size_t padding = (size_t)(-(uintptr_t)arena->next) & (alignment - 1u);
+
+    if ( (size > arena->available) ||
+         (padding > arena->available - size) )  /* need a new block ? */
+    {
+        const size_t bytes = (size > TE_ARENA_BLOCK_SIZE) ?
+            size : TE_ARENA_BLOCK_SIZE;
+        struct arena_block_t * const block =
+            (bytes <= SIZE_MAX - sizeof(struct arena_block_t)) ?
+                malloc(sizeof(struct arena_block_t) + bytes) :
+                NULL;
+
+        if (NULL == block)
+        {
+            out_of_memory(bytes);
+        }
+
+        block->next = arena->blocks;
+        arena->blocks = block;
+        arena->next = block->bytes;
+        arena->available = bytes;
+        padding = 0;    /* each block is aligned for any type */
+    }
+
+    char * const allocated = arena->next + padding;
+    arena->next = allocated + size;
+    arena->available -= padding + size;
+
+    return allocated;
+}
+
+
+/*
+ * Allocate "size" bytes (suitably aligned for any type) from the
+ * arena_t "arena". The memory remains valid until arena_free().
+ * It exits if there is not enough memory.
+ */
+void * arena_alloc(
+    arena_t * const arena,
+    const size_t size)
+{
+    return arena_bump(arena, (size) ? size : 1u, alignof(max_align_t));
+}
+
+
+/*
+ * as strdup_or_die(), but allocated from the arena_t "arena".
+ * Strings need no alignment, so they are packed byte-by-byte.
+ */
+char * arena_strdup_or_die(
+    arena_t * const arena,
+    const char * const str)
+{
+    assert(str);
+
+    const size_t size = strlen(str) + 1u;
+
+    return memcpy(arena_bump(arena, size, 1u), str, size);
+}
+
+
+/*
+ * free all the memory allocated from the arena_t "arena",
+ * leaving it empty.
+ */
+void arena_free(
+    arena_t * const arena)
+{
+    assert(arena);
+
+    struct arena_block_t * block = arena->blocks;
+    while (block)
+    {
+        struct arena_block_t * const next = block->next;
+        free(block);
+        block = next;
+    }
+
+    arena_init(arena);
+}
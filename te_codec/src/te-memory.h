@@ -30,11 +30,12 @@
  *-----------------------------------------------------
  * NOTE:
  *
- * Users of the code are expected to provide their own
- * implementation of a few generic high-level memory
- * management functions, used by the "te-elf-dis" code.
- * Including the completion with their own implementation
- * details of the membuf_t structure.
+ * These are a few generic high-level memory management
+ * functions, used by the "te-elf-dis" code. A reference
+ * implementation is provided in "te-memory.c". Users of
+ * the code may instead provide their own implementation
+ * (see TE_INCLUDE_TE_MEMORY_H in "te-elf-dis.h"),
+ * including their own definition of membuf_t.
  *-----------------------------------------------------
  */
 
@@ -46,14 +47,22 @@
 #include <stddef.h>     /* required for size_t */
 
 
+/*
+ * A growable buffer of bytes.
+ *
+ * By default, the buffer grows geometrically with realloc(3),
+ * so "data" may move whenever the buffer is appended to.
+ * Alternatively, if membuf_reserve() is called first, then
+ * address space is reserved for the largest buffer, and is only
+ * committed (in steps of TE_MEMBUF_COMMIT_SIZE) as it is used,
+ * so "data" never moves.
+ */
 typedef struct
 {
-    void * data;    /* pointer to managed memory */
-    /*
-     * plus any other implementation-specific fields to manage
-     * the memory pointed to by the void pointer 'data'.
-     * e.g. bytes allocated in 'data'.
-     */
+    void * data;        /* pointer to managed memory */
+    size_t length;      /* bytes used in 'data' */
+    size_t capacity;    /* bytes allocated (or committed) in 'data' */
+    size_t reserved;    /* bytes of address space reserved, or 0 */
 } membuf_t;
 
 
@@ -64,6 +73,10 @@ typedef struct
 extern void membuf_init(
     membuf_t * buf);
 
+extern void membuf_reserve(
+    membuf_t * buf,
+    size_t size);
+
 extern size_t membuf_append(
     membuf_t * buf,
     size_t length,
@@ -80,4 +93,32 @@ extern char * strdup_or_die(
     const char * str);
 
 
+/*
+ * A string (and small object) arena: memory is allocated by
+ * bumping a pointer through large blocks, and is all released
+ * at once by arena_free(), rather than individually.
+ */
+typedef struct
+{
+    struct arena_block_t * blocks;  /* most recent block first */
+    char * next;        /* next free byte in the most recent block */
+    size_t available;   /* bytes free after 'next' */
+} arena_t;
+
+
+extern void arena_init(
+    arena_t * arena);
+
+extern void * arena_alloc(
+    arena_t * arena,
+    size_t size);
+
+extern char * arena_strdup_or_die(
+    arena_t * arena,
+    const char * str);
+
+extern void arena_free(
+    arena_t * arena);
+
+
 #endif /* TE_MEMORY_H */
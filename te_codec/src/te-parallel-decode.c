@@ -0,0 +1,544 @@
+/*
+ * Copyright (c) 2020 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "te-parallel-decode.h"
+
+
+/*
+ * The following structure holds the state for a single segment,
+ * of a buffered stream of te_inst packets. See te-parallel-decode.h.
+ */
+typedef struct
+{
+    /* the configuration, as passed to te_parallel_decode() */
+    const te_decoder_state_t * config;
+
+    /* the packets in this segment */
+    const te_inst_t * te_insts;
+    size_t num_te_insts;
+
+    /* most recent support packet before this segment, or NULL if none */
+    const te_inst_t * support;
+
+    /*
+     * What is retained once this segment has been decoded, as its
+     * trace-decoder is then closed: its final error code, and its final
+     * branch predictor table (still a map from its initial state, if
+     * bpred_deferred), of bpred_size entries.
+     */
+    bool decoded;
+    te_error_code_t error_code;
+    uint8_t * bpred_table;      /* [bpred_size] */
+    size_t bpred_size;
+    bool bpred_deferred;
+
+    /* the runs of PCs reconstructed, to be passed on in order */
+    te_decoded_run_t * runs;    /* [max_runs] */
+    size_t num_runs;
+    size_t max_runs;
+} te_segment_t;
+
+
+/*
+ * The following structure holds the work shared by the pool of threads.
+ * All fields (except "segments" and "num_segments") are protected by "lock".
+ */
+typedef struct
+{
+    te_segment_t * segments;    /* [num_segments] */
+    size_t num_segments;
+    size_t next_segment;        /* next segment to be decoded */
+    size_t head_segment;        /* next segment to be passed on */
+    size_t max_in_flight;       /* limit of next_segment - head_segment */
+    bool stopped;               /* true if no more segments are to be decoded */
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     /* signalled when a segment is decoded, or passed on */
+
+    /* the branch predictor at the start of segments[head_segment] */
+    uint8_t bpred_table[TE_BRANCH_PREDICTOR_SIZE];
+} te_parallel_work_t;
+
+
+/*
+ * Call-backs from each segment's trace-decoder. The get_instruction,
+ * get_context_instruction and do_custom_instruction call-backs are
+ * passed on to the user's functions, and must be safe to call
+ * concurrently from a plurality of threads.
+ */
+static unsigned get_segment_instruction(
+    void * const user_data,
+    const te_address_t address,
+    rv_inst * const instruction)
+{
+    const te_segment_t * const segment = (const te_segment_t *)user_data;
+    const te_decoder_state_t * const config = segment->config;
+
+    return (config->get_instruction)(config->user_data, address, instruction);
+}
+
+static unsigned get_segment_context_instruction(
+    void * const user_data,
+    const uint32_t context,
+    const te_address_t address,
+    rv_inst * const instruction)
+{
+    const te_segment_t * const segment = (const te_segment_t *)user_data;
+    const te_decoder_state_t * const config = segment->config;
+
+    return (config->get_context_instruction)(config->user_data, context, address, instruction);
+}
+
+static void do_segment_custom_instruction(
+    void * const user_data,
+    te_decoded_instruction_t * const instr)
+{
+    const te_segment_t * const segment = (const te_segment_t *)user_data;
+    const te_decoder_state_t * const config = segment->config;
+
+    (config->do_custom_instruction)(config->user_data, instr);
+}
+
+static void append_segment_run(
+    void * const user_data,
+    const te_decoded_run_t * const run)
+{
+    te_segment_t * const segment = (te_segment_t *)user_data;
+
+    if (segment->num_runs == segment->max_runs)
+    {
+        segment->max_runs = segment->max_runs ? (2 * segment->max_runs) : 1024u;
+        segment->runs = realloc(segment->runs,
+            segment->max_runs * sizeof(te_decoded_run_t));
+        assert(segment->runs);
+    }
+
+    segment->runs[segment->num_runs++] = *run;
+}
+
+
+/*
+ * Decode all the packets in one segment, with a new trace-decoder,
+ * which is closed again once the segment has been decoded, retaining
+ * only its error code, its branch predictor, and the runs of PCs.
+ *
+ * If "bpred_table" is NULL, then the branch predictor is deferred,
+ * otherwise the branch predictor will start with the given state.
+ */
+static void decode_segment(
+    te_segment_t * const segment,
+    const uint8_t * const bpred_table)
+{
+    assert(segment);
+
+    const te_decoder_state_t * const config = segment->config;
+
+    /* find log2 of the sizes of the decoded_cache[] and cold_cache[] to use */
+    const size_t cache_size = config->decoded_cache_sets * config->decoded_cache_ways;
+    unsigned cache_bits = 0;
+    while (((size_t)1 << cache_bits) < cache_size)
+    {
+        cache_bits++;
+    }
+    unsigned cold_bits = 0;
+    while (((size_t)1 << cold_bits) < config->cold_cache_slots)
+    {
+        cold_bits++;
+    }
+
+    te_decoder_state_t * const decoder = te_open_trace_decoder_with_cache(
+        NULL,
+        get_segment_instruction,
+        (config->do_custom_instruction) ? do_segment_custom_instruction : NULL,
+        NULL,
+        segment,
+        config->isa,
+        cache_bits,
+        config->decoded_cache_ways,
+        cold_bits);
+
+    decoder->advance_decoded_run = append_segment_run;
+    if (config->get_context_instruction)
+    {
+        decoder->get_context_instruction = get_segment_context_instruction;
+    }
+    decoder->discovery_response = config->discovery_response;
+    te_apply_discovery_response(decoder);
+    decoder->options = config->options;
+    decoder->encoder_mode = config->encoder_mode;
+    decoder->shared_image = config->shared_image;
+    decoder->shared_context = config->shared_context;
+
+    if (bpred_table)
+    {
+        memcpy(decoder->bpred.table, bpred_table, decoder->bpred.size);
+    }
+    else
+    {
+        te_defer_bpred_table(decoder);
+    }
+
+    segment->num_runs = 0;
+
+    /* firstly, re-establish the options in force at the start of this segment */
+    if (segment->support)
+    {
+        te_process_te_inst(decoder, segment->support);
+    }
+
+    /* stop immediately, if unresolved (or an error) */
+    for (size_t i = 0;
+         (i < segment->num_te_insts) && (TE_ERROR_OKAY == decoder->error_code);
+         i++)
+    {
+        te_process_te_inst(decoder, &segment->te_insts[i]);
+    }
+
+    if (TE_ERROR_OKAY == decoder->error_code)
+    {
+        te_flush_decoded_run(decoder);
+    }
+
+    /* retain only what is needed to pass on this segment */
+    segment->error_code = decoder->error_code;
+    segment->bpred_deferred = decoder->bpred_deferred;
+    segment->bpred_size = decoder->bpred.size;
+    if (!segment->bpred_table)
+    {
+        segment->bpred_table = malloc(TE_BRANCH_PREDICTOR_SIZE);
+        assert(segment->bpred_table);
+    }
+    assert(segment->bpred_size <= TE_BRANCH_PREDICTOR_SIZE);
+    memcpy(segment->bpred_table, decoder->bpred.table, segment->bpred_size);
+
+    te_close_trace_decoder(decoder);
+}
+
+
+/*
+ * Release all the memory retained by a segment.
+ */
+static void free_segment(
+    te_segment_t * const segment)
+{
+    assert(segment);
+
+    free(segment->runs);
+    segment->runs = NULL;
+    segment->num_runs = 0;
+    segment->max_runs = 0;
+    free(segment->bpred_table);
+    segment->bpred_table = NULL;
+}
+
+
+/*
+ * Claim and decode the next segment, if there is one, and it is within
+ * "max_in_flight" segments of the head. If the claimed segment is the
+ * head, then its branch predictor is already known. Must be called with
+ * the lock held, which is released whilst the segment is decoded.
+ * Returns true if a segment was decoded.
+ */
+static bool decode_next_segment(
+    te_parallel_work_t * const work)
+{
+    uint8_t bpred_table[TE_BRANCH_PREDICTOR_SIZE];
+
+    if ( (work->stopped) ||
+         (work->next_segment >= work->num_segments) ||
+         (work->next_segment - work->head_segment >= work->max_in_flight) )
+    {
+        return false;   /* nothing to do, yet */
+    }
+
+    const size_t index = work->next_segment++;
+    te_segment_t * const segment = &work->segments[index];
+    const bool known = (index == work->head_segment);
+    if (known)
+    {
+        memcpy(bpred_table, work->bpred_table, sizeof(bpred_table));
+    }
+    pthread_mutex_unlock(&work->lock);
+
+    decode_segment(segment, known ? bpred_table : NULL);
+
+    pthread_mutex_lock(&work->lock);
+    segment->decoded = true;
+    pthread_cond_broadcast(&work->changed);
+
+    return true;
+}
+
+
+/*
+ * Each thread in the pool decodes the next segment not yet claimed,
+ * until there are no more segments to be decoded.
+ */
+static void * decode_segments(
+    void * const arg)
+{
+    te_parallel_work_t * const work = (te_parallel_work_t *)arg;
+
+    pthread_mutex_lock(&work->lock);
+    while ( (!work->stopped) &&
+            (work->next_segment < work->num_segments) )
+    {
+        if (!decode_next_segment(work))
+        {
+            /* too far ahead of the head, so wait for it to be passed on */
+            pthread_cond_wait(&work->changed, &work->lock);
+        }
+    }
+    pthread_mutex_unlock(&work->lock);
+
+    return NULL;
+}
+
+
+/*
+ * Pass on the runs of a decoded segment (segments[head_segment]), and
+ * update "bpred_table" to be the branch predictor at its end. If the
+ * segment could not be decoded without knowing its branch predictor,
+ * it is decoded again here, now that it is known.
+ * Returns the segment's error code.
+ */
+static te_error_code_t pass_on_segment(
+    const te_decoder_state_t * const config,
+    te_segment_t * const segment,
+    uint8_t * const bpred_table)
+{
+    if (TE_ERROR_UNRESOLVED_BPRED == segment->error_code)
+    {
+        decode_segment(segment, bpred_table);
+    }
+
+    if (TE_ERROR_OKAY == segment->error_code)
+    {
+        if (segment->bpred_deferred)
+        {
+            te_resolve_bpred_map(segment->bpred_table, segment->bpred_size, bpred_table);
+        }
+        memcpy(bpred_table, segment->bpred_table, segment->bpred_size);
+
+        for (size_t j = 0; j < segment->num_runs; j++)
+        {
+            (config->advance_decoded_run)(config->user_data, &segment->runs[j]);
+        }
+    }
+
+    const te_error_code_t error_code = segment->error_code;
+    free_segment(segment);
+
+    return error_code;
+}
+
+
+/*
+ * Split the buffered te_inst packets into segments, which may be decoded
+ * independently. Returns the number of segments, which are written to
+ * "segments" (which must be large enough for one per packet).
+ */
+static size_t split_into_segments(
+    const te_decoder_state_t * const config,
+    const te_inst_t * const te_insts,
+    const size_t num_te_insts,
+    te_segment_t * const segments)
+{
+    size_t num_segments = 0;
+    bool start_of_trace = config->start_of_trace;
+    bool carry = false;     /* is a miss-predict carried to the next packet ? */
+    const te_inst_t * support = NULL;
+
+    for (size_t i = 0; i < num_te_insts; i++)
+    {
+        const te_inst_t * const te_inst = &te_insts[i];
+        bool split = false;
+
+        if (TE_INST_FORMAT_3_SYNC != te_inst->format)
+        {
+            carry = (TE_INST_FORMAT_0_EXTN == te_inst->format) &&
+                    (TE_INST_EXTN_BRANCH_PREDICTOR == te_inst->extension) &&
+                    (!te_inst->with_address);
+        }
+        else if (TE_INST_SUBFORMAT_SUPPORT == te_inst->subformat)
+        {
+            support = te_inst;
+            if ( (TE_QUAL_STATUS_ENDED_UPD == te_inst->support.qual_status) ||
+                 (TE_QUAL_STATUS_ENDED_REP == te_inst->support.qual_status) )
+            {
+                start_of_trace = true;
+            }
+        }
+        else if (TE_INST_SUBFORMAT_CONTEXT != te_inst->subformat)
+        {
+            split = ( (TE_INST_SUBFORMAT_START == te_inst->subformat) && (start_of_trace) ) ||
+                    ( (TE_INST_SUBFORMAT_EXCEPTION == te_inst->subformat) && (!carry) );
+            start_of_trace = false;
+            carry = false;
+        }
+
+        if ( (0 == num_segments) ||
+             ( (split) &&
+               (segments[num_segments - 1].num_te_insts >= TE_PARALLEL_MIN_PACKETS) ) )
+        {
+            te_segment_t * const segment = &segments[num_segments++];
+            memset(segment, 0, sizeof(*segment));
+            segment->config = config;
+            segment->te_insts = te_inst;
+            segment->support = (0 == i) ? NULL : support;
+        }
+
+        segments[num_segments - 1].num_te_insts++;
+    }
+
+    return num_segments;
+}
+
+
+/*
+ * Decode a buffered stream of te_inst packets, using a pool of
+ * "num_threads" threads, each decoding one segment at a time.
+ *
+ * The trace-decoder "config" is not itself used to decode any packets,
+ * rather it supplies the configuration (and call-backs) for each of the
+ * segments' trace-decoders, and is otherwise unchanged. It should have
+ * been opened with te_open_trace_decoder(), and must have the call-back
+ * advance_decoded_run assigned, as PCs are passed on in runs. Runs are
+ * passed on in order, by the calling thread, as soon as each segment
+ * (and all before it) has been decoded, but will additionally end
+ * (with TE_RUN_END_FLUSH) at the end of each segment. At most
+ * TE_PARALLEL_SEGMENTS_PER_THREAD segments per thread are decoded
+ * ahead of those passed on. The call-backs get_instruction,
+ * get_context_instruction and do_custom_instruction (if not NULL)
+ * will be called concurrently from all the threads, and must be
+ * thread-safe.
+ *
+ * Returns TE_ERROR_OKAY if all the packets were decoded successfully,
+ * otherwise the error code of the first segment that failed (in which
+ * case, no runs from any subsequent segment are passed on).
+ */
+te_error_code_t te_parallel_decode(
+    const te_decoder_state_t * const config,
+    const te_inst_t * const te_insts,
+    const size_t num_te_insts,
+    const unsigned num_threads)
+{
+    te_error_code_t error_code = TE_ERROR_OKAY;
+
+    assert(config);
+    assert(config->advance_decoded_run);
+    assert(te_insts || !num_te_insts);
+
+    if (0 == num_te_insts)
+    {
+        return TE_ERROR_OKAY;   /* nothing to do */
+    }
+
+    te_parallel_work_t work =
+    {
+        .segments = malloc(num_te_insts * sizeof(te_segment_t)),
+        .next_segment = 0,
+        .head_segment = 0,
+        .stopped = false,
+    };
+    assert(work.segments);
+    work.num_segments = split_into_segments(config, te_insts, num_te_insts, work.segments);
+    work.segments = realloc(work.segments, work.num_segments * sizeof(te_segment_t));
+    assert(work.segments);
+    assert(config->bpred.size <= sizeof(work.bpred_table));
+    memcpy(work.bpred_table, config->bpred.table, config->bpred.size);
+    pthread_mutex_init(&work.lock, NULL);
+    pthread_cond_init(&work.changed, NULL);
+
+    /* start the pool of threads, and then join in with them */
+    const size_t max_threads =
+        (num_threads < work.num_segments) ? num_threads : work.num_segments;
+    work.max_in_flight = (max_threads ? max_threads : 1u) * TE_PARALLEL_SEGMENTS_PER_THREAD;
+    pthread_t * const threads = malloc(max_threads * sizeof(pthread_t));
+    assert(threads || !max_threads);
+    size_t num_started = 0;
+    while ( (num_started + 1 < max_threads) &&
+            (0 == pthread_create(&threads[num_started], NULL, decode_segments, &work)) )
+    {
+        num_started++;
+    }
+
+    /*
+     * The calling thread also decodes segments, but in preference, it
+     * passes on the head segment (in order) as soon as it is decoded,
+     * resolving its branch predictor from the end of the previous one.
+     */
+    uint8_t bpred_table[TE_BRANCH_PREDICTOR_SIZE];
+    memcpy(bpred_table, config->bpred.table, config->bpred.size);
+
+    pthread_mutex_lock(&work.lock);
+    while ( (!work.stopped) &&
+            (work.head_segment < work.num_segments) )
+    {
+        te_segment_t * const segment = &work.segments[work.head_segment];
+
+        if (segment->decoded)
+        {
+            pthread_mutex_unlock(&work.lock);
+            error_code = pass_on_segment(config, segment, bpred_table);
+            pthread_mutex_lock(&work.lock);
+
+            work.head_segment++;
+            memcpy(work.bpred_table, bpred_table, config->bpred.size);
+            work.stopped = (TE_ERROR_OKAY != error_code);
+            pthread_cond_broadcast(&work.changed);
+        }
+        else if (!decode_next_segment(&work))
+        {
+            pthread_cond_wait(&work.changed, &work.lock);
+        }
+    }
+    work.stopped = true;
+    pthread_cond_broadcast(&work.changed);
+    pthread_mutex_unlock(&work.lock);
+
+    for (size_t i = 0; i < num_started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    pthread_cond_destroy(&work.changed);
+    pthread_mutex_destroy(&work.lock);
+
+    /* discard any segments decoded beyond the first that failed */
+    for (size_t i = work.head_segment; i < work.next_segment; i++)
+    {
+        free_segment(&work.segments[i]);
+    }
+    free(work.segments);
+
+    return error_code;
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2020 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TE_PARALLEL_DECODE_H
+#define TE_PARALLEL_DECODE_H
+
+
+#include "decoder-algorithm-public.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/*
+ * A buffered stream of te_inst packets may be split at certain
+ * synchronization packets into a number of independent segments,
+ * with each segment being decoded concurrently, by its own instance
+ * of a trace-decoder, on a pool of threads.
+ *
+ * A segment may only start at a format 3 packet which discards all
+ * the state accumulated from the preceding packets. That is either:
+ *      a subformat 0 (start) packet, at the start of a trace, or
+ *      a subformat 1 (exception) packet, as this expunges all the
+ *      pending branches, and does not follow the execution path.
+ * The implicit return stack is emptied on both, and the trace-encoder
+ * will only ever reference an entry in the jump target cache, after it
+ * has been re-written following a sync. However, the branch predictor
+ * is not re-initialized on a sync, and so each segment (but the first)
+ * is decoded with its branch predictor deferred (te_defer_bpred_table()).
+ * Once the previous segment is complete, its final branch predictor
+ * resolves that of the next segment, or if a prediction was needed
+ * before that entry was re-built, the segment is decoded again.
+ *
+ * Segments shorter than TE_PARALLEL_MIN_PACKETS packets are not split.
+ */
+#if !defined(TE_PARALLEL_MIN_PACKETS)
+#   define TE_PARALLEL_MIN_PACKETS  (256u)
+#endif  /* TE_PARALLEL_MIN_PACKETS */
+
+
+/*
+ * Each segment's trace-decoder is closed as soon as the segment has been
+ * decoded, but its runs of PCs are retained until they can be passed on,
+ * in order. To bound the memory used, no more than this number of segments
+ * per thread are decoded ahead of the oldest segment not yet passed on.
+ */
+#if !defined(TE_PARALLEL_SEGMENTS_PER_THREAD)
+#   define TE_PARALLEL_SEGMENTS_PER_THREAD  (4u)
+#endif  /* TE_PARALLEL_SEGMENTS_PER_THREAD */
+
+
+/*
+ * The following are external functions DEFINED by this code.
+ * See the associated C source file for their semantics.
+ */
+extern te_error_code_t te_parallel_decode(
+    const te_decoder_state_t * const config,
+    const te_inst_t * const te_insts,
+    const size_t num_te_insts,
+    const unsigned num_threads);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif  /* TE_PARALLEL_DECODE_H */
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2020 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "te-shared-image.h"
+
+
+/*
+ * the state of each slot in a shared image
+ */
+typedef enum
+{
+    TE_SHARED_SLOT_EMPTY = 0,   /* never been written */
+    TE_SHARED_SLOT_BUSY,        /* claimed, and being written */
+    TE_SHARED_SLOT_READY        /* written, and never changes again */
+} te_shared_slot_state_t;
+
+
+/*
+ * The following structure is a single slot in a shared image.
+ * Only "state" is accessed atomically. Both "context" and "instr"
+ * are written (once) whilst the slot is TE_SHARED_SLOT_BUSY, and
+ * are only read once the slot is seen to be TE_SHARED_SLOT_READY.
+ */
+typedef struct
+{
+    atomic_uint state;              /* te_shared_slot_state_t */
+    uint64_t context;
+    te_hot_instruction_t instr;     /* "instr.pc" is the address */
+} te_shared_slot_t;
+
+
+struct te_shared_image_t
+{
+    size_t mask;                    /* number of slots, minus one */
+    te_shared_slot_t * slots;       /* [mask + 1] */
+};
+
+
+/*
+ * Return the index of the first slot to probe, for the key (context, address).
+ */
+static size_t get_shared_slot(
+    const te_shared_image_t * const image,
+    const uint64_t context,
+    const te_address_t address)
+{
+    const uint64_t key = (address >> 1) ^ ((context << 32) | (context >> 32));
+
+    /* multiplicative hash, taking the most significant bits */
+    return (size_t)((key * UINT64_C(0x9e3779b97f4a7c15)) >> 32) & image->mask;
+}
+
+
+/*
+ * Create a new (empty) shared image, with 2^size_bits slots.
+ * Each instruction decoded occupies one slot, so this should be
+ * somewhat larger than the total number of distinct instructions
+ * expected to be executed. The image should be released with
+ * te_close_shared_image(), once no trace-decoders are using it.
+ */
+te_shared_image_t * te_open_shared_image(
+    const unsigned size_bits)
+{
+    assert(size_bits < 8 * sizeof(size_t));
+
+    te_shared_image_t * const image = malloc(sizeof(te_shared_image_t));
+    assert(image);
+
+    image->mask = ((size_t)1 << size_bits) - 1u;
+    image->slots = malloc((image->mask + 1u) * sizeof(te_shared_slot_t));
+    assert(image->slots);
+
+    for (size_t i = 0; i <= image->mask; i++)
+    {
+        atomic_init(&image->slots[i].state, TE_SHARED_SLOT_EMPTY);
+    }
+
+    return image;
+}
+
+
+/*
+ * Release all the memory allocated by te_open_shared_image().
+ */
+void te_close_shared_image(
+    te_shared_image_t * const image)
+{
+    if (image)
+    {
+        free(image->slots);
+        free(image);
+    }
+}
+
+
+/*
+ * Return a pointer to the hot record for the key (context, address),
+ * in the shared image, or NULL if it is not (yet) present.
+ * The record pointed to will never change, until the image is closed.
+ *
+ * This never blocks, and may be called concurrently with any other
+ * calls to te_find_shared_instr() and te_insert_shared_instr().
+ */
+const te_hot_instruction_t * te_find_shared_instr(
+    const te_shared_image_t * const image,
+    const uint64_t context,
+    const te_address_t address)
+{
+    assert(image);
+
+    size_t index = get_shared_slot(image, context, address);
+
+    for (unsigned probe = 0; probe < TE_SHARED_IMAGE_MAX_PROBES; probe++)
+    {
+        te_shared_slot_t * const slot = &image->slots[index];
+        const unsigned state = atomic_load_explicit(&slot->state, memory_order_acquire);
+
+        if (TE_SHARED_SLOT_EMPTY == state)
+        {
+            return NULL;    /* not present */
+        }
+
+        if ( (TE_SHARED_SLOT_READY == state)    &&
+             (slot->instr.pc == address)        &&
+             (slot->context == context) )
+        {
+            return &slot->instr;    /* found it */
+        }
+
+        /* otherwise, try the next slot (linear probing) */
+        index = (index + 1u) & image->mask;
+    }
+
+    return NULL;    /* not present */
+}
+
+
+/*
+ * Insert a copy of the hot record "instr" into the shared image, for
+ * the key (context, instr->pc). If the image is too full, or the key
+ * is already present, then this does nothing.
+ *
+ * This never blocks, and may be called concurrently with any other
+ * calls to te_find_shared_instr() and te_insert_shared_instr().
+ * Very rarely, if two threads insert the same key at the same time,
+ * then both copies may be inserted, but all subsequent lookups will
+ * find the same one of them.
+ */
+void te_insert_shared_instr(
+    te_shared_image_t * const image,
+    const uint64_t context,
+    const te_hot_instruction_t * const instr)
+{
+    assert(image);
+    assert(instr);
+
+    size_t index = get_shared_slot(image, context, instr->pc);
+
+    for (unsigned probe = 0; probe < TE_SHARED_IMAGE_MAX_PROBES; probe++)
+    {
+        te_shared_slot_t * const slot = &image->slots[index];
+        unsigned state = TE_SHARED_SLOT_EMPTY;
+
+        /* try and claim this slot, if it is empty */
+        if (atomic_compare_exchange_strong_explicit(
+                &slot->state,
+                &state,
+                TE_SHARED_SLOT_BUSY,
+                memory_order_acquire,
+                memory_order_acquire))
+        {
+            slot->context = context;
+            slot->instr = *instr;
+            atomic_store_explicit(&slot->state, TE_SHARED_SLOT_READY, memory_order_release);
+            return;     /* inserted */
+        }
+
+        if ( (TE_SHARED_SLOT_READY == state)    &&
+             (slot->instr.pc == instr->pc)      &&
+             (slot->context == context) )
+        {
+            return;     /* already present */
+        }
+
+        /* otherwise, try the next slot (linear probing) */
+        index = (index + 1u) & image->mask;
+    }
+
+    /* the image is too full, so do not insert it */
+}
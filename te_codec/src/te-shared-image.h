@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2020 UltraSoC Technologies Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef TE_SHARED_IMAGE_H
+#define TE_SHARED_IMAGE_H
+
+
+#include "decoder-algorithm-public.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/*
+ * A shared image is a store of decoded hot instruction records
+ * (te_hot_instruction_t), which may be shared by any number of
+ * trace-decoders, on any number of threads. Records are keyed by their
+ * address, and by a 64-bit "context" (e.g. an ASID), so that different
+ * address spaces may share a single image. A trace-decoder uses its
+ * shared_context (a user-chosen namespace) as the upper 32 bits, and
+ * the context reported in the te_inst packets as the lower 32 bits.
+ *
+ * Each trace-decoder still has its own private decoded_cache[], but on
+ * a miss it will first look in the shared image (if it has one), before
+ * calling get_instruction to decode the instruction itself, after which
+ * it will insert its decode into the shared image, for all to use.
+ * Thus, each instruction in the image is decoded once per process,
+ * rather than once per trace-decoder.
+ *
+ * The shared image is an open-addressed hash table, of a fixed size.
+ * Each record is written exactly once, and is thereafter never changed,
+ * so lookups never take a lock. If the table becomes too full (more
+ * than TE_SHARED_IMAGE_MAX_PROBES slots must be searched), then further
+ * records are simply not inserted, and trace-decoders decode privately.
+ *
+ * All trace-decoders sharing an image must decode the same instructions
+ * identically, for the same context. In particular, they should all have
+ * the same do_custom_instruction call-back (or none), and ISA.
+ */
+#if !defined(TE_SHARED_IMAGE_MAX_PROBES)
+#   define TE_SHARED_IMAGE_MAX_PROBES   (16u)
+#endif  /* TE_SHARED_IMAGE_MAX_PROBES */
+
+typedef struct te_shared_image_t te_shared_image_t;
+
+
+/*
+ * The following are external functions DEFINED by this code.
+ * See the associated C source file for their semantics.
+ */
+extern te_shared_image_t * te_open_shared_image(
+    const unsigned size_bits);
+
+extern void te_close_shared_image(
+    te_shared_image_t * const image);
+
+extern const te_hot_instruction_t * te_find_shared_instr(
+    const te_shared_image_t * const image,
+    const uint64_t context,
+    const te_address_t address);
+
+extern void te_insert_shared_instr(
+    te_shared_image_t * const image,
+    const uint64_t context,
+    const te_hot_instruction_t * const instr);
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+#endif  /* TE_SHARED_IMAGE_H */